@@ -26,6 +26,8 @@ CameraConfig::CameraConfig()
     nearPlane(0.1f),
     farPlane(1000),
     initialTranslation(QVector3D()),
+    origin(DVector3()),
+    rebaseDistance(0),
     WorldForward(Camera::LocalForward),
     WorldRight(Camera::LocalRight),
     WorldUp(Camera::LocalUp)
@@ -35,6 +37,7 @@ Camera::Camera()
   : m_config(),
     aspectRatio(1),
     distance(0),
+    m_reverseZ(false),
     m_dirty(true)
 {
   setConfig(m_config);
@@ -59,7 +62,9 @@ void Camera::translate(const QVector3D &dt) {
   m_translation += dt;
 
   distance = (m_target - m_translation).length();
-  updateFrustum();
+  if (distanceDependentFrustum())
+    updateFrustum();
+  rebaseIfFar();
 }
 
 void Camera::rotate(const QQuaternion &dr) {
@@ -81,7 +86,9 @@ void Camera::setTranslation(const QVector3D &t) {
   m_translation = t;
 
   distance = (m_target - m_translation).length();
-  updateFrustum();
+  if (distanceDependentFrustum())
+    updateFrustum();
+  rebaseIfFar();
 }
 
 void Camera::setRotation(const QQuaternion &r) {
@@ -101,11 +108,31 @@ void Camera::setTarget(const QVector3D &t) {
   QVector3D delta = m_translation - m_target;
   m_rotation = QQuaternion::fromDirection(delta, upVector());
   distance = delta.length();
-  updateFrustum();
+  if (distanceDependentFrustum())
+    updateFrustum();
 
   emit targetChanged(m_target);
 }
 
+void Camera::setOrigin(const DVector3 &origin) {
+  // the shift is calculated in double precision and small if the origin is close
+  const QVector3D shift = (m_origin - origin).toVector3D();
+
+  m_dirty = true;
+  m_origin = origin;
+  m_translation += shift;
+  m_target += shift;
+}
+
+void Camera::rebase() {
+  setOrigin(worldTranslation());
+}
+
+void Camera::rebaseIfFar() {
+  if (m_config.rebaseDistance > 0 && m_translation.length() > m_config.rebaseDistance)
+    rebase();
+}
+
 void Camera::setCameraMode(CameraMode mode) {
   m_config.c_mode = mode;
   emit cameraModeChanged(mode);
@@ -132,6 +159,13 @@ void Camera::setAspectRatio(float r) {
 }
 
 
+void Camera::setReverseZ(bool reverse) {
+  m_dirty = true;
+  m_reverseZ = reverse;
+  updateFrustum();
+}
+
+
 void Camera::updateFrustum() {
   float zNear = m_config.nearPlane;
   float zFar = std::max(2.0f * distance, m_config.farPlane);
@@ -139,20 +173,46 @@ void Camera::updateFrustum() {
   m_projection.setToIdentity();
 
   if (m_config.p_mode == ProjectionMode::Perspective) {
-    m_projection.perspective(m_config.fov, aspectRatio, zNear, zFar);
+    if (m_reverseZ) {
+      // infinite far plane: z_ndc = zNear / -z_eye, i.e., 1 at the near plane, 0 at infinity
+      float f = 1.0f / std::tan(degToRad(m_config.fov / 2.0f));
+      m_projection = QMatrix4x4(f / aspectRatio, 0,  0, 0,
+                                0,               f,  0, 0,
+                                0,               0,  0, zNear,
+                                0,               0, -1, 0);
+    } else {
+      m_projection.perspective(m_config.fov, aspectRatio, zNear, zFar);
+    }
   } else if (m_config.p_mode == ProjectionMode::Orthographic) {
     float left = -aspectRatio * distance * std::tan(degToRad(m_config.fov / 2.0f));
     float right = aspectRatio * distance * std::tan(degToRad(m_config.fov / 2.0f));
     float bottom = -distance * std::tan(degToRad(m_config.fov / 2.0f));
     float top = distance * std::tan(degToRad(m_config.fov / 2.0f));
 
+    if (m_reverseZ) {
+      // map [-1, 1] to [1, 0]
+      m_projection = QMatrix4x4(1, 0,  0,    0,
+                                0, 1,  0,    0,
+                                0, 0, -0.5f, 0.5f,
+                                0, 0,  0,    1);
+    }
+
     m_projection.ortho(left, right, bottom, top, zNear, zFar);
   }
 }
 
+bool Camera::distanceDependentFrustum() const {
+  // the infinite reverse-Z perspective is the same at every distance
+  return !(m_reverseZ && m_config.p_mode == ProjectionMode::Perspective);
+}
+
 void Camera::reset() {
+  m_origin = m_config.origin;
+
+  // the target is the origin, even if setting the translation rebases it
+  m_target = QVector3D();
   setTranslation(m_config.initialTranslation);
-  setTarget(0, 0, 0);
+  setTarget(m_target);
 
   m_rotation = m_worldToLocal.conjugated();
 }
@@ -160,14 +220,29 @@ void Camera::reset() {
 
 // Accessors
 const QMatrix4x4 &Camera::toMatrix() {
+  updateMatrices();
+  return m_world;
+}
+
+QMatrix4x4 Camera::toMatrix(const DVector3 &origin) {
+  updateMatrices();
+
+  // only the small offset from the camera goes into the float matrix
+  QMatrix4x4 m = m_projectionRotation;
+  m.translate((origin - worldTranslation()).toVector3D());
+  return m;
+}
+
+void Camera::updateMatrices() {
   if (m_dirty) {
     m_dirty = false;
-    m_world.setToIdentity();
-    m_world.rotate(m_rotation.conjugated());
+    m_projectionRotation.setToIdentity();
+    m_projectionRotation.rotate(m_rotation.conjugated());
+    m_projectionRotation = m_projection * m_projectionRotation;
+
+    m_world = m_projectionRotation;
     m_world.translate(-m_translation);
-    m_world = m_projection * m_world;
   }
-  return m_world;
 }
 
 // Queries
@@ -194,6 +269,7 @@ bool Camera::upsideDown() const {
 #ifndef QT_NO_DEBUG_STREAM
 QDebug operator<<(QDebug dbg, const Camera &transform) {
   dbg << "Camera\n{\n";
+  dbg << "Origin: <" << transform.origin().x << ", " << transform.origin().y << ", " << transform.origin().z << ">\n";
   dbg << "Position: <" << transform.translation().x() << ", " << transform.translation().y() << ", " << transform.translation().z() << ">\n";
   dbg << "Rotation: <" << transform.rotation().x() << ", " << transform.rotation().y() << ", " << transform.rotation().z() << " | " << transform.rotation().scalar() << ">\n}";
   return dbg;
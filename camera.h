@@ -5,6 +5,8 @@
 #include <QQuaternion>
 #include <QMatrix4x4>
 
+#include "dvector3.h"
+
 
 enum class CameraMode
 {
@@ -31,6 +33,14 @@ struct CameraConfig
 
   QVector3D initialTranslation;
 
+  // world position (double precision) that the camera's translation and target
+  // are relative to, so the camera stays precise far away from (0, 0, 0)
+  DVector3 origin;
+
+  // floating origin: when the camera gets farther away from its origin than
+  // this, the origin is moved to the camera; 0 to keep the origin fixed
+  float rebaseDistance;
+
   // the actual directions (world coordinates): how to interpret x,y,z
   // i.e., what are the coordinates of an forward/right/up vector in world coordinates?
   QVector3D WorldForward;
@@ -46,6 +56,7 @@ public:
   Camera();
 
   void setConfig(const CameraConfig &config);
+  const CameraConfig & config() const;
 
   // Constants
   static const QVector3D LocalForward;
@@ -70,11 +81,20 @@ public:
   void setTarget(const QVector3D &t);
   void setTarget(float x, float y, float z);
 
+  // move the origin, keeping the camera and target in place in world coordinates
+  void setOrigin(const DVector3 &origin);
+  void rebase();
+
   void setCameraMode(CameraMode mode);
   void setProjectionMode(ProjectionMode mode);
 
   void setAspectRatio(float r);
 
+  // reverse-Z: depth 1 at the near plane, 0 at infinity (perspective) or the
+  // far plane (orthographic); needs a [0, 1] depth range, see QGLViewer::setReverseZ()
+  void setReverseZ(bool reverse);
+  bool reverseZ() const;
+
   void reset();
 
   // Accessors
@@ -82,9 +102,18 @@ public:
   const QQuaternion & rotation() const;
   const QVector3D & target() const;
   const QMatrix4x4 & projection() const;
+  const DVector3 & origin() const;
+
+  // camera position in double precision world coordinates
+  DVector3 worldTranslation() const;
 
+  // for vertices relative to the camera's origin
   const QMatrix4x4 & toMatrix();
 
+  // camera-relative: for vertices relative to the given world position, e.g., a chunk origin;
+  // the offset to the camera is calculated in double precision
+  QMatrix4x4 toMatrix(const DVector3 &origin);
+
   CameraMode cameraMode() const;
   ProjectionMode projectionMode() const;
 
@@ -107,10 +136,15 @@ signals:
 
 private:
   void updateFrustum();
+  bool distanceDependentFrustum() const;
+  void updateMatrices();
+  void rebaseIfFar();
 
   CameraConfig m_config;
   QQuaternion m_worldToLocal;
 
+  DVector3 m_origin;        // translation and target are relative to it
+
   QVector3D m_target;       // in target mode: reference point
 
   QVector3D m_translation;
@@ -119,9 +153,11 @@ private:
 
   float aspectRatio;        // aspect radio
   float distance;           // distance from camera to target
+  bool m_reverseZ;
 
   // if dirty, recalc m_world transformation
   QMatrix4x4 m_world;
+  QMatrix4x4 m_projectionRotation;   // m_world without the translation
   bool m_dirty;
 };
 
@@ -139,13 +175,17 @@ inline void Camera::setRotation(float angle, const QVector3D &axis) { setRotatio
 inline void Camera::setRotation(float angle, float ax, float ay, float az) { setRotation(QQuaternion::fromAxisAndAngle(ax, ay, az, angle)); }
 
 // Accessors
+inline const CameraConfig & Camera::config()            const { return m_config; }
 inline const QVector3D &  Camera::target()              const { return m_target; }
 inline const QVector3D &  Camera::translation()         const { return m_translation; }
 inline const QQuaternion& Camera::rotation()            const { return m_rotation; }
 inline const QMatrix4x4 & Camera::projection()          const { return m_projection; }
+inline const DVector3 &   Camera::origin()              const { return m_origin; }
+inline DVector3           Camera::worldTranslation()    const { return m_origin + m_translation; }
 
 inline CameraMode         Camera::cameraMode()          const { return m_config.c_mode; }
 inline ProjectionMode     Camera::projectionMode()      const { return m_config.p_mode; }
+inline bool               Camera::reverseZ()            const { return m_reverseZ; }
 
 
 
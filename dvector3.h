@@ -0,0 +1,31 @@
+#ifndef DVECTOR3_H
+#define DVECTOR3_H
+
+#include <QVector3D>
+
+
+/**
+ * A position in double precision world coordinates, e.g., the origin of a
+ * chunk or of the camera, for camera-relative rendering of large coordinates.
+ */
+struct DVector3
+{
+  DVector3() : x(0), y(0), z(0) {}
+  DVector3(double x, double y, double z) : x(x), y(y), z(z) {}
+  explicit DVector3(const QVector3D &v) : x(v.x()), y(v.y()), z(v.z()) {}
+
+  // only precise if the vector is small, e.g., an offset from the camera
+  QVector3D toVector3D() const { return QVector3D(float(x), float(y), float(z)); }
+
+  double x, y, z;
+};
+
+inline DVector3 operator+(const DVector3 &a, const DVector3 &b) { return DVector3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline DVector3 operator-(const DVector3 &a, const DVector3 &b) { return DVector3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline DVector3 operator+(const DVector3 &a, const QVector3D &b) { return a + DVector3(b); }
+inline DVector3 operator-(const DVector3 &a, const QVector3D &b) { return a - DVector3(b); }
+
+inline bool operator==(const DVector3 &a, const DVector3 &b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+inline bool operator!=(const DVector3 &a, const DVector3 &b) { return !(a == b); }
+
+#endif  // DVECTOR3_H
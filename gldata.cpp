@@ -1,5 +1,10 @@
 #include "gldata.h"
 
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <map>
+
 
 void GLData::addVertex(const QVector3D &a, const QVector3D &color, QVector<GLfloat> &data) {
   data.push_back(a.x());
@@ -12,15 +17,42 @@ void GLData::addVertex(const QVector3D &a, const QVector3D &color, QVector<GLflo
 }
 
 
-void GLData::addLine(const QVector3D &a, const QVector3D &b, const QVector3D &color) {
+void GLData::addLine(const QVector3D &a, const QVector3D &b, const QVector3D &color, float width) {
   addVertex(a, color, m_lines);
   addVertex(b, color, m_lines);
+  m_lineWidths.push_back(width);
 }
 
 void GLData::addTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c, const QVector3D &color) {
+  addTriangle(a, b, c, color, 0x7);
+}
+
+void GLData::addTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c, const QVector3D &color, GLubyte featureEdges) {
   addVertex(a, color, m_tris);
   addVertex(b, color, m_tris);
   addVertex(c, color, m_tris);
+  m_featureEdges.push_back(featureEdges);
+}
+
+void GLData::addPoint(const QVector3D &a, const QVector3D &color) {
+  auto toByte = [](float c) { return GLubyte(qRound(qBound(0.0f, c, 1.0f) * 255)); };
+
+  m_points.push_back({ { a.x(), a.y(), a.z() },
+                       { toByte(color.x()), toByte(color.y()), toByte(color.z()), 255 } });
+}
+
+void GLData::addLabel(const QVector3D &a, const QString &text, const QVector3D &color, float priority) {
+  m_labels.push_back({ a, text, color, priority });
+}
+
+bool GLData::setScalars(const QVector<GLfloat> &scalars) {
+  if (!scalars.isEmpty() && scalars.size() != triangleVertexCount()) {
+    std::cerr << "ERROR: " << scalars.size() << " scalars for " << triangleVertexCount() << " triangle vertices" << std::endl;
+    return false;
+  }
+
+  m_scalars = scalars;
+  return true;
 }
 
 void GLData::addCuboid(const QVector3D &u1left, const QVector3D &u1right, const QVector3D &u2left, const QVector3D &u2right,
@@ -34,36 +66,347 @@ void GLData::addCuboid(const QVector3D &u1left, const QVector3D &u1right, const
   QVector3D l2right = u2right + pnormal;
 
   // top green
-  if (sides & TOP) {
-    addTriangle(u1left, u1right, u2left, QVector3D(0, 1 - fracGreen, fracBlue));
-    addTriangle(u1right, u2right, u2left, QVector3D(0, 1 - fracGreen, fracBlue));
-  }
+  if (sides & TOP)
+    addQuad(u1left, u1right, u2right, u2left, QVector3D(0, 1 - fracGreen, fracBlue));
 
   // right, front blue
-  if (sides & RIGHT) {
-    addTriangle(u1right, l1right, u2right, QVector3D(0, 0, 1));
-    addTriangle(l1right, l2right, u2right, QVector3D(0, 0, 1));
+  if (sides & RIGHT)
+    addQuad(u1right, l1right, l2right, u2right, QVector3D(0, 0, 1));
+
+  if (sides & FRONT)
+    addQuad(l2left, u2left, u2right, l2right, QVector3D(0, 0, 1));
+
+  // left, back yellow
+  if (sides & LEFT)
+    addQuad(u1left, u2left, l2left, l1left, QVector3D(1, 1, 0));
+
+  if (sides & BACK)
+    addQuad(l1right, u1right, u1left, l1left, QVector3D(1, 1, 0));
+
+  // bottom red
+  if (sides & BOTTOM)
+    addQuad(l1left, l2left, l2right, l1right, QVector3D(1 - fracGreen, 0, fracBlue));
+}
+
+void GLData::addQuad(const QVector3D &a, const QVector3D &b, const QVector3D &c, const QVector3D &d, const QVector3D &color) {
+  if (m_inCuboids) {
+    m_faces.push_back({ { a, b, c, d }, color });
+    return;
   }
 
-  if (sides & FRONT) {
-    addTriangle(u2left, u2right, l2right, QVector3D(0, 0, 1));
-    addTriangle(u2left, l2right, l2left, QVector3D(0, 0, 1));
+  // the diagonal b-d isn't a feature edge
+  addTriangle(a, b, d, color, 0x1 | 0x4);
+  addTriangle(b, c, d, color, 0x1 | 0x2);
+}
+
+
+void GLData::beginCuboids(bool mergeFaces) {
+  if (m_inCuboids) {
+    std::cerr << "WARNING: nested cuboid set, closing the previous one" << std::endl;
+    endCuboids();
   }
 
-  // left, back yellow
-  if (sides & LEFT) {
-    addTriangle(u1left, u2left, l1left, QVector3D(1, 1, 0));
-    addTriangle(l1left, u2left, l2left, QVector3D(1, 1, 0));
+  m_inCuboids = true;
+  m_mergeFaces = mergeFaces;
+}
+
+GLData::CuboidStats GLData::endCuboids() {
+  CuboidStats stats;
+  if (!m_inCuboids)
+    return stats;
+
+  m_inCuboids = false;
+
+  stats.triangles = 2 * m_faces.size();
+  stats.hiddenTriangles = 2 * removeHiddenFaces(m_faces);
+  if (m_mergeFaces)
+    stats.mergedTriangles = 2 * mergeFaces(m_faces);
+
+  if (m_mergeFaces) {
+    stats.junctionTriangles = addFaces(m_faces);
+  } else {
+    for (const Face &face : m_faces)
+      addQuad(face.corners[0], face.corners[1], face.corners[2], face.corners[3], face.color);
   }
 
-  if (sides & BACK) {
-    addTriangle(u1right, u1left, l1left, QVector3D(1, 1, 0));
-    addTriangle(u1right, l1left, l1right, QVector3D(1, 1, 0));
+  m_faces.clear();
+  return stats;
+}
+
+
+// corners closer than this are considered equal
+static const float epsilon = 1.0f / 1024;
+
+typedef std::array<qint64, 3> GridPoint;
+
+static GridPoint gridPoint(const QVector3D &v) {
+  return {{ qRound64(v.x() / epsilon), qRound64(v.y() / epsilon), qRound64(v.z() / epsilon) }};
+}
+
+static QVector3D faceNormal(const QVector3D (&corners)[4]) {
+  return QVector3D::normal(corners[0], corners[1], corners[3]);
+}
+
+int GLData::removeHiddenFaces(QVector<Face> &faces) {
+  // faces with the same corners, in any order
+  std::map<std::array<GridPoint, 4>, QVector<int>> coincident;
+  for (int i = 0; i < faces.size(); ++i) {
+    const QVector3D *corners = faces[i].corners;
+    std::array<GridPoint, 4> key = {{ gridPoint(corners[0]), gridPoint(corners[1]), gridPoint(corners[2]), gridPoint(corners[3]) }};
+    std::sort(key.begin(), key.end());
+    coincident[key].push_back(i);
   }
 
-  // bottom red
-  if (sides & BOTTOM) {
-    addTriangle(l1left, l2left, l1right, QVector3D(1 - fracGreen, 0, fracBlue));
-    addTriangle(l1right, l2left, l2right, QVector3D(1 - fracGreen, 0, fracBlue));
+  // two faces facing each other lie between two cuboids and hide each other
+  QVector<bool> hidden(faces.size(), false);
+  int count = 0;
+
+  for (const auto &entry : coincident) {
+    const QVector<int> &indices = entry.second;
+
+    for (int i = 0; i < indices.size(); ++i) {
+      for (int j = i + 1; j < indices.size() && !hidden[indices[i]]; ++j) {
+        if (hidden[indices[j]])
+          continue;
+
+        if (QVector3D::dotProduct(faceNormal(faces[indices[i]].corners), faceNormal(faces[indices[j]].corners)) < 0) {
+          hidden[indices[i]] = hidden[indices[j]] = true;
+          count += 2;
+        }
+      }
+    }
+  }
+
+  QVector<Face> visible;
+  visible.reserve(faces.size() - count);
+  for (int i = 0; i < faces.size(); ++i)
+    if (!hidden[i])
+      visible.push_back(faces[i]);
+
+  faces.swap(visible);
+  return count;
+}
+
+
+// whether q lies on the straight way from p to r
+static bool collinear(const QVector3D &p, const QVector3D &q, const QVector3D &r) {
+  QVector3D u = q - p;
+  QVector3D v = r - q;
+  return QVector3D::dotProduct(u, v) > 0
+      && QVector3D::crossProduct(u, v).lengthSquared() <= 1e-6f * u.lengthSquared() * v.lengthSquared();
+}
+
+int GLData::mergeFaces(QVector<Face> &faces) {
+  // directed edge from corner to corner in a plane (by normal) -> face
+  typedef std::array<GridPoint, 3> EdgeKey;
+
+  auto edgeKey = [&faces](int face, int from, int to) -> EdgeKey {
+    const QVector3D *corners = faces[face].corners;
+    return {{ gridPoint(corners[from % 4]), gridPoint(corners[to % 4]), gridPoint(faceNormal(faces[face].corners)) }};
+  };
+
+  std::map<EdgeKey, int> edges;
+  for (int f = 0; f < faces.size(); ++f)
+    for (int i = 0; i < 4; ++i)
+      edges[edgeKey(f, i, i + 1)] = f;
+
+  QVector<bool> merged(faces.size(), false);
+  int count = 0;
+
+  for (int f = 0; f < faces.size(); ++f) {
+    if (merged[f])
+      continue;
+
+    // grow the face as long as it has a neighbor to merge with
+    bool grown = true;
+    while (grown) {
+      grown = false;
+
+      for (int i = 0; i < 4 && !grown; ++i) {
+        // a coplanar neighbor runs along the shared edge in the opposite direction
+        auto it = edges.find(edgeKey(f, i + 1, i));
+        if (it == edges.end())
+          continue;
+
+        int g = it->second;
+        if (g == f || merged[g] || faces[g].color != faces[f].color)
+          continue;
+
+        const QVector3D *a = faces[f].corners;
+        const QVector3D *b = faces[g].corners;
+
+        int j = 0;
+        while (j < 4 && gridPoint(b[j]) != gridPoint(a[(i + 1) % 4]))
+          ++j;
+        if (j == 4 || gridPoint(b[(j + 1) % 4]) != gridPoint(a[i]))
+          continue;
+
+        // the union is a quad if the edges next to the shared one continue each other
+        if (!collinear(a[(i + 3) % 4], a[i], b[(j + 2) % 4]) || !collinear(b[(j + 3) % 4], b[j], a[(i + 2) % 4]))
+          continue;
+
+        for (int face : { f, g }) {
+          for (int k = 0; k < 4; ++k) {
+            auto edge = edges.find(edgeKey(face, k, k + 1));
+            if (edge != edges.end() && edge->second == face)
+              edges.erase(edge);
+          }
+        }
+
+        Face face = { { a[(i + 2) % 4], a[(i + 3) % 4], b[(j + 2) % 4], b[(j + 3) % 4] }, faces[f].color };
+        faces[f] = face;
+
+        for (int k = 0; k < 4; ++k)
+          edges[edgeKey(f, k, k + 1)] = f;
+
+        merged[g] = true;
+        grown = true;
+        ++count;
+      }
+    }
   }
+
+  QVector<Face> remaining;
+  remaining.reserve(faces.size() - count);
+  for (int f = 0; f < faces.size(); ++f)
+    if (!merged[f])
+      remaining.push_back(faces[f]);
+
+  faces.swap(remaining);
+  return count;
+}
+
+int GLData::addFaces(const QVector<Face> &faces) {
+  // a line through an edge: its direction, pointing either way, and the point closest to the origin
+  typedef std::array<GridPoint, 2> LineKey;
+
+  auto lineKey = [](const QVector3D &a, const QVector3D &b, QVector3D &dir) -> LineKey {
+    dir = (b - a).normalized();
+    const float first = std::abs(dir.x()) > epsilon ? dir.x() : (std::abs(dir.y()) > epsilon ? dir.y() : dir.z());
+    if (first < 0)
+      dir = dir * -1.0f;
+
+    return {{ gridPoint(dir), gridPoint(a - dir * QVector3D::dotProduct(a, dir)) }};
+  };
+
+  // the corners of the edges on each line; a T-junction is one of them within an edge on the same line
+  std::map<LineKey, QVector<QVector3D>> lines;
+  QVector3D dir;
+  for (const Face &face : faces) {
+    for (int k = 0; k < 4; ++k) {
+      QVector<QVector3D> &points = lines[lineKey(face.corners[k], face.corners[(k + 1) % 4], dir)];
+      points.push_back(face.corners[k]);
+      points.push_back(face.corners[(k + 1) % 4]);
+    }
+  }
+
+  int added = 0;
+
+  for (const Face &face : faces) {
+    // the outline of the face, with the corners of its neighbors within its edges
+    QVector<QVector3D> outline;
+    int corner[4];
+    bool split[4];
+
+    for (int k = 0; k < 4; ++k) {
+      const QVector3D &a = face.corners[k];
+      const QVector3D &b = face.corners[(k + 1) % 4];
+      const QVector<QVector3D> &points = lines[lineKey(a, b, dir)];
+
+      const float ta = QVector3D::dotProduct(a, dir);
+      const float tb = QVector3D::dotProduct(b, dir);
+      const float sign = tb > ta ? 1 : -1;
+
+      // by the distance from a
+      std::map<float, QVector3D> within;
+      for (const QVector3D &p : points) {
+        const float t = sign * (QVector3D::dotProduct(p, dir) - ta);
+        if (t > epsilon && t < sign * (tb - ta) - epsilon)
+          within.emplace(t, p);
+      }
+
+      corner[k] = outline.size();
+      outline.push_back(a);
+
+      float last = 0;
+      for (const auto &p : within) {
+        if (p.first - last > epsilon)
+          outline.push_back(p.second);
+        last = p.first;
+      }
+
+      split[k] = outline.size() > corner[k] + 1;
+    }
+
+    if (outline.size() == 4) {
+      addQuad(face.corners[0], face.corners[1], face.corners[2], face.corners[3], face.color);
+      continue;
+    }
+
+    // a fan from a corner whose edges have no T-junction, or else from the center of the face;
+    // edges between consecutive outline points are feature edges, those to the fan center aren't
+    const int n = outline.size();
+    int center = -1;
+    for (int k = 0; k < 4 && center < 0; ++k)
+      if (!split[k] && !split[(k + 3) % 4])
+        center = corner[k];
+
+    if (center > -1) {
+      for (int i = 1; i < n - 1; ++i) {
+        const GLubyte edges = (i == 1 ? 0x1 : 0) | 0x2 | (i == n - 2 ? 0x4 : 0);
+        addTriangle(outline[center], outline[(center + i) % n], outline[(center + i + 1) % n], face.color, edges);
+      }
+      added += n - 4;
+    } else {
+      const QVector3D middle = (face.corners[0] + face.corners[1] + face.corners[2] + face.corners[3]) * 0.25f;
+      for (int i = 0; i < n; ++i)
+        addTriangle(middle, outline[i], outline[(i + 1) % n], face.color, 0x2);
+      added += n - 2;
+    }
+  }
+
+  return added;
+}
+
+
+void GLData::beginObject(const QString &name) {
+  if (m_inObject) {
+    std::cerr << "WARNING: nested object " << name.toStdString() << ", closing the previous one" << std::endl;
+    endObject();
+  }
+
+  m_openObject = { name, triangleVertexCount(), 0 };
+  m_inObject = true;
+}
+
+void GLData::endObject() {
+  if (!m_inObject)
+    return;
+
+  m_openObject.vertexCount = triangleVertexCount() - m_openObject.firstVertex;
+  m_objects.push_back(m_openObject);
+  m_inObject = false;
+}
+
+
+void GLData::beginChunk(const DVector3 &origin) {
+  if (m_inChunk) {
+    std::cerr << "WARNING: nested chunk, closing the previous one" << std::endl;
+    endChunk();
+  }
+
+  m_chunks.push_back({ origin, triangleVertexCount(), 0, lineVertexCount(), 0, pointCount(), 0, labelCount(), 0 });
+  m_inChunk = true;
+}
+
+void GLData::endChunk() {
+  if (!m_inChunk)
+    return;
+
+  Chunk &chunk = m_chunks.last();
+  chunk.vertexCount = triangleVertexCount() - chunk.firstVertex;
+  chunk.lineVertexCount = lineVertexCount() - chunk.firstLineVertex;
+  chunk.pointCount = pointCount() - chunk.firstPoint;
+  chunk.labelCount = labelCount() - chunk.firstLabel;
+  m_inChunk = false;
 }
@@ -4,10 +4,13 @@
 #include <qopengl.h>
 #include <QVector>
 #include <QVector3D>
+#include <QString>
+
+#include "dvector3.h"
 
 
 /**
- * This class stores points for drawing lines and triangles.
+ * This class stores points for drawing lines, triangles and point clouds.
  */
 class GLData
 {
@@ -22,15 +25,48 @@ public:
   inline int lineVertexCount() const        { return lineDataSize() / 6; }
   inline int triangleVertexCount() const    { return triangleDataSize() / 6; }
 
+  // the feature edges of a triangle: bit i is set if the edge from its vertex i to the
+  // next is an edge of the surface, not a diagonal that splits a quad into triangles
+  inline GLubyte featureEdges(int triangle) const { return m_featureEdges[triangle]; }
+
+  // a point of a point cloud, 16 bytes
+  struct Point {
+    GLfloat position[3];
+    GLubyte color[4];     // rgba
+  };
+
+  const Point *pointConstData() const       { return m_points.constData(); }
+  Point *pointData()                        { return m_points.data(); }     // to reorder them, see GLPoints
+  inline int pointCount() const             { return m_points.size(); }
+
+  // a text anchored at a position, drawn at a fixed size in pixels
+  struct Label {
+    QVector3D position;
+    QString text;
+    QVector3D color;
+    float priority;       // of overlapping labels, the one with the higher priority is drawn
+  };
+
+  const QVector<Label> &labels() const      { return m_labels; }
+  inline int labelCount() const             { return m_labels.size(); }
+
+  inline void resizeLabelCount(int size)    { m_labels.resize(size); }
+
   inline void resizeLineVertexCount(int size) {
     m_lines.resize(size * 6);
+    m_lineWidths.resize(size / 2);
   }
 
+  // the width of a line in pixels
+  inline GLfloat lineWidth(int line) const  { return m_lineWidths[line]; }
+
 
   /**
    * Add a line.
+   *
+   * @param width in pixels, independent of the distance
    */
-  void addLine(const QVector3D &a, const QVector3D &b, const QVector3D &color);
+  void addLine(const QVector3D &a, const QVector3D &b, const QVector3D &color, float width = 2);
 
   /**
    * Add a triangle.
@@ -39,6 +75,32 @@ public:
    */
   void addTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c, const QVector3D &color);
 
+  /**
+   * Add a point, drawn as a sprite of a fixed size in pixels.
+   */
+  void addPoint(const QVector3D &a, const QVector3D &color);
+
+  /**
+   * Add a label, drawn to the right of its position unless it would overlap
+   * a label of higher (or same, but added earlier) priority.
+   */
+  void addLabel(const QVector3D &a, const QString &text, const QVector3D &color, float priority = 0);
+
+  /**
+   * Set one scalar per triangle vertex, e.g., a temperature or an error,
+   * which QGLViewer can map to colors on the GPU instead of the vertex
+   * colors. Set them once all triangles are added; an empty vector removes
+   * them.
+   *
+   * @return false if there isn't exactly one scalar per triangle vertex
+   */
+  bool setScalars(const QVector<GLfloat> &scalars);
+
+  // false as well if triangles were added after the scalars
+  inline bool hasScalars() const            { return !m_scalars.isEmpty() && m_scalars.size() == triangleVertexCount(); }
+  const GLfloat *scalarConstData() const    { return m_scalars.constData(); }
+  inline int scalarCount() const            { return m_scalars.size(); }
+
   enum Sides : char {
     NONE    = 0,
     ALL     = ~0,
@@ -62,12 +124,130 @@ public:
   void addCuboid(const QVector3D &u1left, const QVector3D &u1right, const QVector3D &u2left, const QVector3D &u2right,
               float thickness, float fracGreen, float fracBlue, Sides sides = ALL);
 
+
+  /**
+   * Triangle counts of a cuboid set, see endCuboids().
+   */
+  struct CuboidStats {
+    int triangles = 0;          // of all faces added to the set
+    int hiddenTriangles = 0;    // removed because they touch a face of a neighbor
+    int mergedTriangles = 0;    // saved by merging coplanar faces
+    int junctionTriangles = 0;  // added again to split merged faces at T-junctions
+  };
+
+  /**
+   * Start a set of cuboids. The faces of all cuboids added until endCuboids()
+   * are collected instead of added right away, so that faces between adjacent
+   * cuboids can be dropped and coplanar faces of the same color can be merged.
+   *
+   * The cuboids must be closed and opaque; sets cannot be nested, and objects
+   * and chunks must not begin or end within a set.
+   *
+   * @param mergeFaces whether to greedily merge coplanar faces into larger ones;
+   *        where a corner of another face of the set lies within an edge of a
+   *        merged face, the merged face is triangulated through that corner, so
+   *        there are no T-junctions within the set; other triangles of the data
+   *        aren't considered
+   */
+  void beginCuboids(bool mergeFaces = false);
+
+  /**
+   * Remove the hidden faces of the set, merge the remaining ones and add them.
+   */
+  CuboidStats endCuboids();
+
+
+  /**
+   * A named range of triangle vertices that can be hidden, moved and tinted
+   * in QGLViewer without rebuilding and re-uploading the data.
+   */
+  struct Object {
+    QString name;
+    int firstVertex;    // first triangle vertex of the object
+    int vertexCount;    // number of triangle vertices
+  };
+
+  /**
+   * Start a named object. All triangles added until endObject() belong to it.
+   * Objects cannot be nested. An object that is never closed isn't one, its
+   * triangles belong to no object.
+   */
+  void beginObject(const QString &name);
+  void endObject();
+
+  const QVector<Object> &objects() const    { return m_objects; }
+  const Object *openObject() const          { return m_inObject ? &m_openObject : nullptr; }
+
+
+  /**
+   * A range of triangle and line vertices, points and labels whose
+   * positions are relative to an origin in double precision world
+   * coordinates. Chunks are drawn camera-relative, so large (e.g.,
+   * georeferenced) coordinates don't jitter. Point clouds split into chunks
+   * are also subsampled per chunk.
+   */
+  struct Chunk {
+    DVector3 origin;
+    int firstVertex;        // first triangle vertex
+    int vertexCount;
+    int firstLineVertex;
+    int lineVertexCount;
+    int firstPoint;
+    int pointCount;
+    int firstLabel;
+    int labelCount;
+  };
+
+  /**
+   * Start a chunk. The positions of all vertices added until endChunk() are
+   * relative to origin. Chunks cannot be nested; objects must not cross
+   * chunk boundaries.
+   */
+  void beginChunk(const DVector3 &origin);
+  void endChunk();
+
+  const QVector<Chunk> &chunks() const      { return m_chunks; }
+
 private:
   // add a vertex a with color to the given data vector
   void addVertex(const QVector3D &a, const QVector3D &color, QVector<GLfloat> &data);
 
+  // add a triangle with the given feature edges
+  void addTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c, const QVector3D &color, GLubyte featureEdges);
+
+  // add a planar quad as two triangles, or collect it in a cuboid set
+  void addQuad(const QVector3D &a, const QVector3D &b, const QVector3D &c, const QVector3D &d, const QVector3D &color);
+
+  // a cuboid face, the corners are in counterclockwise order seen from the front
+  struct Face {
+    QVector3D corners[4];
+    QVector3D color;
+  };
+
+  static int removeHiddenFaces(QVector<Face> &faces);
+  static int mergeFaces(QVector<Face> &faces);
+
+  // add the faces as triangles without T-junctions, return the triangles more than two per face
+  int addFaces(const QVector<Face> &faces);
+
   QVector<GLfloat> m_lines;
+  QVector<GLfloat> m_lineWidths;    // one per line
   QVector<GLfloat> m_tris;
+  QVector<GLubyte> m_featureEdges;  // one per triangle
+  QVector<GLfloat> m_scalars;       // none or one per triangle vertex
+  QVector<Point> m_points;
+  QVector<Label> m_labels;
+
+  QVector<Object> m_objects;
+  Object m_openObject;
+  bool m_inObject = false;
+
+  QVector<Chunk> m_chunks;
+  bool m_inChunk = false;
+
+  QVector<Face> m_faces;
+  bool m_inCuboids = false;
+  bool m_mergeFaces = false;
 };
 
 #endif  // GLDATA_H
@@ -0,0 +1,379 @@
+#include "gllabels.h"
+#include "camera.h"
+
+#include <QFontMetricsF>
+#include <QOpenGLContext>
+#include <QPainter>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <numeric>
+
+
+// labels start this far to the right of their position, in pixels
+static const GLfloat labelPadding = 4;
+
+// size of the cells that track the occupied screen area, in pixels
+static const int cellSize = 8;
+
+static const int atlasWidth = 512;
+
+
+GLLabels::GLLabels()
+  : m_lineHeight(0),
+    m_atlasDirty(false),
+    m_supported(false),
+    m_quadVbo(QOpenGLBuffer::VertexBuffer),
+    m_atlasTexture(0)
+{
+  m_font.setPixelSize(13);
+}
+
+
+void GLLabels::setData(const GLData &data, int gridLabelIdx, int axesLabelIdx) {
+  m_source = data.labels();
+
+  m_sourceCategories.resize(m_source.size());
+  for (int l = 0; l < m_source.size(); ++l)
+    m_sourceCategories[l] = l < gridLabelIdx ? DataLabels : (l < axesLabelIdx ? GridLabels : AxesLabels);
+
+  m_sourceChunks.fill(-1, m_source.size());
+  m_dataOrigins.clear();
+  for (int c = 0; c < data.chunks().size(); ++c) {
+    const GLData::Chunk &chunk = data.chunks()[c];
+    for (int l = chunk.firstLabel; l < chunk.firstLabel + chunk.labelCount; ++l)
+      m_sourceChunks[l] = c;
+
+    m_dataOrigins.push_back(chunk.origin);
+  }
+
+  // a new atlas only for characters it doesn't have yet
+  QString chars;
+  for (const GLData::Label &label : m_source)
+    for (QChar c : label.text)
+      if (!m_glyphIndex.contains(c) && !chars.contains(c))
+        chars += c;
+
+  if (m_glyphs.isEmpty() || !chars.isEmpty())
+    buildAtlas(chars);
+
+  layout();
+}
+
+void GLLabels::setFont(const QFont &font) {
+  m_font = font;
+  buildAtlas(QString());
+  layout();
+}
+
+void GLLabels::takeData(const GLLabels &prepared) {
+  m_font = prepared.m_font;
+  m_lineHeight = prepared.m_lineHeight;
+
+  m_source = prepared.m_source;
+  m_sourceCategories = prepared.m_sourceCategories;
+  m_sourceChunks = prepared.m_sourceChunks;
+  m_dataOrigins = prepared.m_dataOrigins;
+
+  m_glyphIndex = prepared.m_glyphIndex;
+  m_glyphs = prepared.m_glyphs;
+  m_atlas = prepared.m_atlas;
+  m_atlasDirty = true;
+
+  m_positions = prepared.m_positions;
+  m_chunkSlots = prepared.m_chunkSlots;
+  m_categories = prepared.m_categories;
+  m_sizes = prepared.m_sizes;
+  m_colors = prepared.m_colors;
+  m_firstGlyph = prepared.m_firstGlyph;
+  m_labelGlyphs = prepared.m_labelGlyphs;
+  m_chunkOrigins = prepared.m_chunkOrigins;
+}
+
+
+void GLLabels::buildAtlas(const QString &chars) {
+  // printable ASCII, the characters of the current atlas and the new ones
+  QString all;
+  for (char c = ' '; c <= '~'; ++c)
+    all += QChar(c);
+  for (auto it = m_glyphIndex.constBegin(); it != m_glyphIndex.constEnd(); ++it)
+    if (!all.contains(it.key()))
+      all += it.key();
+  all += chars;
+
+  const QFontMetricsF metrics(m_font);
+  m_lineHeight = std::ceil(metrics.height());
+
+  auto advance = [&metrics](QChar c) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+    return std::ceil(metrics.horizontalAdvance(c));
+#else
+    return std::ceil(metrics.width(c));
+#endif
+  };
+
+  // rows of glyphs, with a pixel of space around each so linear filtering doesn't bleed
+  QVector<QPointF> positions;
+  qreal x = 1, y = 1;
+  for (QChar c : all) {
+    const qreal w = advance(c);
+    if (x + w + 1 > atlasWidth) {
+      x = 1;
+      y += m_lineHeight + 2;
+    }
+
+    positions.push_back(QPointF(x, y));
+    x += w + 2;
+  }
+
+  const int height = int(y + m_lineHeight + 1);
+
+  m_atlas = QImage(atlasWidth, height, QImage::Format_RGBA8888_Premultiplied);
+  m_atlas.fill(Qt::transparent);
+
+  QPainter painter(&m_atlas);
+  painter.setFont(m_font);
+  painter.setPen(Qt::white);
+
+  m_glyphIndex.clear();
+  m_glyphs.clear();
+
+  for (int i = 0; i < all.size(); ++i) {
+    const QPointF &p = positions[i];
+    const GLfloat w = advance(all[i]);
+    painter.drawText(QPointF(p.x(), p.y() + metrics.ascent()), QString(all[i]));
+
+    // the image is uploaded top row first, so the bottom of a glyph is at the larger t
+    Glyph glyph = { w, { GLfloat(p.x() / atlasWidth), GLfloat((p.y() + m_lineHeight) / height),
+                         w / atlasWidth, -m_lineHeight / height } };
+
+    m_glyphIndex.insert(all[i], m_glyphs.size());
+    m_glyphs.push_back(glyph);
+  }
+
+  m_atlasDirty = true;
+}
+
+void GLLabels::layout() {
+  m_positions.clear();
+  m_chunkSlots.clear();
+  m_categories.clear();
+  m_sizes.clear();
+  m_colors.clear();
+  m_firstGlyph.clear();
+  m_labelGlyphs.clear();
+  m_chunkOrigins = { DVector3() };
+
+  // higher priority first, the order of the data otherwise
+  QVector<int> order(m_source.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    return m_source[a].priority > m_source[b].priority;
+  });
+
+  // chunk => slot
+  QHash<int, int> slots;
+  slots.insert(-1, 0);
+
+  for (int l : order) {
+    const GLData::Label &label = m_source[l];
+
+    auto slot = slots.constFind(m_sourceChunks[l]);
+    if (slot == slots.constEnd()) {
+      slot = slots.insert(m_sourceChunks[l], m_chunkOrigins.size());
+      m_chunkOrigins.push_back(m_dataOrigins[m_sourceChunks[l]]);
+    }
+
+    m_firstGlyph.push_back(m_labelGlyphs.size());
+
+    GLfloat width = 0;
+    for (QChar c : label.text) {
+      const int glyph = m_glyphIndex.value(c, -1);
+      if (glyph < 0)
+        continue;
+
+      // spaces take room, but aren't drawn
+      if (!c.isSpace())
+        m_labelGlyphs.push_back({ width, glyph });
+      width += m_glyphs[glyph].width;
+    }
+
+    m_positions << label.position.x() << label.position.y() << label.position.z();
+    m_chunkSlots.push_back(slot.value());
+    m_categories.push_back(m_sourceCategories[l]);
+    m_sizes << width << m_lineHeight;
+    m_colors << label.color.x() << label.color.y() << label.color.z();
+  }
+
+  m_firstGlyph.push_back(m_labelGlyphs.size());
+}
+
+
+void GLLabels::place(Camera *camera, const QSizeF &viewportSize, const bool shown[3], QVector<Instance> &instances) {
+  const GLfloat w = viewportSize.width();
+  const GLfloat h = viewportSize.height();
+
+  m_matrices.resize(m_chunkOrigins.size());
+  for (int slot = 0; slot < m_chunkOrigins.size(); ++slot)
+    m_matrices[slot] = camera->toMatrix(m_chunkOrigins[slot]);
+
+  const int cols = int(std::ceil(w / cellSize));
+  const int rows = int(std::ceil(h / cellSize));
+  int freeCells = cols * rows;
+  m_occupied.fill(0, freeCells);
+
+  const int labelCount = m_sizes.size() / 2;
+  for (int l = 0; l < labelCount && freeCells > 0; ++l) {
+    if (!shown[m_categories[l]])
+      continue;
+
+    // column-major
+    const float *m = m_matrices[m_chunkSlots[l]].constData();
+    const GLfloat *p = &m_positions[3 * l];
+
+    const GLfloat clipW = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15];
+    if (clipW <= 0)
+      continue;
+
+    const GLfloat ndcX = (m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12]) / clipW;
+    const GLfloat ndcY = (m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13]) / clipW;
+
+    // the label's rectangle in pixels, origin bottom left
+    const GLfloat x0 = (ndcX * 0.5f + 0.5f) * w + labelPadding;
+    const GLfloat y0 = (ndcY * 0.5f + 0.5f) * h - 0.5f * m_sizes[2 * l + 1];
+    const GLfloat x1 = x0 + m_sizes[2 * l];
+    const GLfloat y1 = y0 + m_sizes[2 * l + 1];
+
+    if (x1 <= 0 || y1 <= 0 || x0 >= w || y0 >= h)
+      continue;
+
+    const int c0 = std::max(int(x0) / cellSize, 0);
+    const int c1 = std::min(int(x1) / cellSize, cols - 1);
+    const int r0 = std::max(int(y0) / cellSize, 0);
+    const int r1 = std::min(int(y1) / cellSize, rows - 1);
+
+    bool overlaps = false;
+    for (int r = r0; r <= r1 && !overlaps; ++r)
+      for (int c = c0; c <= c1 && !overlaps; ++c)
+        overlaps = m_occupied[r * cols + c] != 0;
+
+    if (overlaps)
+      continue;
+
+    for (int r = r0; r <= r1; ++r)
+      for (int c = c0; c <= c1; ++c)
+        m_occupied[r * cols + c] = 1;
+
+    freeCells -= (r1 - r0 + 1) * (c1 - c0 + 1);
+
+    for (int g = m_firstGlyph[l]; g < m_firstGlyph[l + 1]; ++g) {
+      const LabelGlyph &lg = m_labelGlyphs[g];
+      const Glyph &glyph = m_glyphs[lg.glyph];
+
+      instances.push_back({ { ndcX, ndcY },
+                            { labelPadding + lg.offset, -0.5f * m_lineHeight, glyph.width, m_lineHeight },
+                            { glyph.texRect[0], glyph.texRect[1], glyph.texRect[2], glyph.texRect[3] },
+                            { m_colors[3 * l], m_colors[3 * l + 1], m_colors[3 * l + 2] } });
+    }
+  }
+}
+
+
+
+void GLLabels::initializeGL() {
+  initializeOpenGLFunctions();
+
+  QOpenGLContext *ctx = QOpenGLContext::currentContext();
+  m_supported = ctx->isOpenGLES()
+      ? ctx->format().version() >= qMakePair(3, 0)
+      : ctx->format().version() >= qMakePair(3, 3);
+
+  if (!m_supported) {
+    std::cerr << "WARNING: no instanced arrays, labels are not drawn" << std::endl;
+    return;
+  }
+
+  static const GLfloat quad[] = { 0, 0,  1, 0,  0, 1,  1, 1 };
+
+  if (!m_quadVbo.create())
+    std::cerr << "ERROR: failed to create label buffer" << std::endl;
+
+  m_quadVbo.bind();
+  m_quadVbo.allocate(quad, sizeof(quad));
+  m_quadVbo.release();
+
+  glGenTextures(1, &m_atlasTexture);
+  glBindTexture(GL_TEXTURE_2D, m_atlasTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_atlasDirty = true;
+}
+
+void GLLabels::destroyGL() {
+  m_quadVbo.destroy();
+
+  if (m_atlasTexture != 0)
+    glDeleteTextures(1, &m_atlasTexture);
+
+  m_atlasTexture = 0;
+  m_supported = false;
+}
+
+
+void GLLabels::upload() {
+  if (!m_supported || !m_atlasDirty || m_atlas.isNull())
+    return;
+
+  m_atlasDirty = false;
+
+  glBindTexture(GL_TEXTURE_2D, m_atlasTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_atlas.width(), m_atlas.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, m_atlas.constBits());
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GLLabels::setupVertexAttribs(QOpenGLBuffer &instances) {
+  if (!m_supported)
+    return;
+
+  m_quadVbo.bind();
+  glEnableVertexAttribArray(CornerAttrib);
+  glVertexAttribPointer(CornerAttrib, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+  m_quadVbo.release();
+
+  instances.bind();
+
+  const struct {
+    Attrib attrib;
+    int size;
+    size_t offset;
+  } attribs[] = {
+    { AnchorAttrib, 2, offsetof(Instance, anchor) },
+    { GlyphAttrib, 4, offsetof(Instance, glyph) },
+    { TexRectAttrib, 4, offsetof(Instance, texRect) },
+    { ColorAttrib, 3, offsetof(Instance, color) }
+  };
+
+  for (const auto &a : attribs) {
+    glEnableVertexAttribArray(a.attrib);
+    glVertexAttribPointer(a.attrib, a.size, GL_FLOAT, GL_FALSE, sizeof(Instance), reinterpret_cast<void *>(a.offset));
+    glVertexAttribDivisor(a.attrib, 1);
+  }
+
+  instances.release();
+}
+
+void GLLabels::draw(int instanceCount) {
+  if (!m_supported || instanceCount == 0)
+    return;
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_atlasTexture);
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
@@ -0,0 +1,148 @@
+#ifndef GLLABELS_H
+#define GLLABELS_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLBuffer>
+#include <QFont>
+#include <QHash>
+#include <QImage>
+#include <QMatrix4x4>
+#include <QSizeF>
+
+#include "gldata.h"
+
+QT_FORWARD_DECLARE_CLASS(Camera)
+
+
+/**
+ * The labels of a GLData, drawn from a glyph atlas with one instanced draw
+ * per viewport: every glyph is an instance of the same unit quad.
+ *
+ * The atlas is generated once from a QFont and the labels are laid out once,
+ * in setData(). Per frame, place() projects the anchors, drops the labels off
+ * screen and those that would overlap a label of higher priority, and emits
+ * the glyphs of the rest; only these are uploaded. Needs instanced arrays
+ * (OpenGL 3.3 or OpenGL ES 3.0).
+ */
+class GLLabels : protected QOpenGLExtraFunctions
+{
+public:
+  // vertex attribute locations of the label program
+  enum Attrib {
+    CornerAttrib  = 0,    // of the unit quad
+    AnchorAttrib  = 1,    // per glyph: the label position in normalized device coordinates
+    GlyphAttrib   = 2,    // offset from the anchor and size in pixels
+    TexRectAttrib = 3,    // atlas texture coordinates of the bottom left corner, and size
+    ColorAttrib   = 4
+  };
+
+  // which part of the scene a label belongs to; can be hidden per view
+  enum Category {
+    DataLabels,
+    GridLabels,
+    AxesLabels
+  };
+
+  // a glyph on the screen, one instance of the quad
+  struct Instance {
+    GLfloat anchor[2];
+    GLfloat glyph[4];
+    GLfloat texRect[4];
+    GLfloat color[3];
+  };
+
+  GLLabels();
+
+  // CPU side, may be called without a current context; the grid and axes
+  // are the data labels from gridLabelIdx and axesLabelIdx on
+  void setData(const GLData &data, int gridLabelIdx, int axesLabelIdx);
+
+  // copy the CPU side of labels prepared elsewhere, with their font and atlas
+  void takeData(const GLLabels &prepared);
+
+  // regenerates the atlas and the layout of the labels
+  void setFont(const QFont &font);
+  const QFont &font() const                       { return m_font; }
+
+  bool isEmpty() const                            { return m_sizes.isEmpty(); }
+
+  /**
+   * Append the glyphs of the labels to draw in a viewport of the given size
+   * in pixels. Labels are placed greedily in the order of their priority;
+   * one that overlaps an already placed label is dropped. The occupied area
+   * is tracked in a coarse grid of cells, so the test is a few byte lookups.
+   *
+   * @param shown whether the data, grid and axes labels are shown
+   */
+  void place(Camera *camera, const QSizeF &viewportSize, const bool shown[3], QVector<Instance> &instances);
+
+  // GPU side, the context has to be current
+  void initializeGL();
+  void destroyGL();
+
+  // instanced arrays are available
+  bool isSupported() const                        { return m_supported; }
+
+  // the atlas, if it changed
+  void upload();
+
+  // setup the shared quad and the given per-view instance buffer in the currently bound VAO
+  void setupVertexAttribs(QOpenGLBuffer &instances);
+
+  // draw the instances in the buffer, with the atlas bound to texture unit 0
+  void draw(int instanceCount);
+
+private:
+  // a character in the atlas
+  struct Glyph {
+    GLfloat width;          // advance in pixels
+    GLfloat texRect[4];
+  };
+
+  // a character of a laid out label
+  struct LabelGlyph {
+    GLfloat offset;         // from the left of the label in pixels
+    int glyph;              // index in m_glyphs
+  };
+
+  // render the characters into the atlas image
+  void buildAtlas(const QString &chars);
+
+  // the glyphs of all labels, sorted by priority
+  void layout();
+
+  QFont m_font;
+  GLfloat m_lineHeight;
+
+  QVector<GLData::Label> m_source;      // the labels to lay out
+  QVector<Category> m_sourceCategories;
+  QVector<int> m_sourceChunks;          // -1 if not in a chunk
+  QVector<DVector3> m_dataOrigins;      // of the chunks of the data
+
+  QHash<QChar, int> m_glyphIndex;
+  QVector<Glyph> m_glyphs;
+  QImage m_atlas;
+  bool m_atlasDirty;
+
+  // the laid out labels in the order of their priority, in separate arrays for the projection pass
+  QVector<GLfloat> m_positions;         // x, y, z relative to the chunk origin
+  QVector<int> m_chunkSlots;            // index in m_chunkOrigins
+  QVector<Category> m_categories;
+  QVector<GLfloat> m_sizes;             // width, height in pixels
+  QVector<GLfloat> m_colors;            // r, g, b
+  QVector<int> m_firstGlyph;            // in m_labelGlyphs, one more than labels
+  QVector<LabelGlyph> m_labelGlyphs;
+
+  // the origins of the chunks with labels, slot 0 is the world origin
+  QVector<DVector3> m_chunkOrigins;
+
+  // per frame
+  QVector<QMatrix4x4> m_matrices;       // by chunk slot
+  QVector<quint8> m_occupied;           // cells of the screen
+
+  bool m_supported;
+  QOpenGLBuffer m_quadVbo;
+  GLuint m_atlasTexture;
+};
+
+#endif  // GLLABELS_H
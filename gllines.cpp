@@ -0,0 +1,127 @@
+#include "gllines.h"
+
+#include <iostream>
+
+
+// floats per quad vertex: position (3), other end (3), color (3), params (4)
+static const int vertexSize = 13;
+
+
+GLLines::GLLines()
+  : m_vbo(QOpenGLBuffer::VertexBuffer)
+{}
+
+
+void GLLines::setData(const GLData &data, int gridVertexIdx, int axesVertexIdx) {
+  m_vertices.clear();
+  m_spans.clear();
+
+  const int lineCount = data.lineVertexCount() / 2;
+  const int gridLine = gridVertexIdx / 2;
+  const int axesLine = axesVertexIdx / 2;
+
+  // the lines of the data that are in a chunk
+  QVector<bool> inChunk(gridLine, false);
+  for (const GLData::Chunk &chunk : data.chunks())
+    for (int l = chunk.firstLineVertex / 2; l < (chunk.firstLineVertex + chunk.lineVertexCount) / 2; ++l)
+      inChunk[l] = true;
+
+  // first everything in absolute world coordinates, in one span...
+  for (int l = 0; l < gridLine; ++l)
+    if (!inChunk[l])
+      addSegment(data, l, DataLines);
+
+  for (int l = gridLine; l < lineCount; ++l)
+    addSegment(data, l, l < axesLine ? GridLines : AxesLines);
+
+  int vertexCount = m_vertices.size() / vertexSize;
+  if (vertexCount > 0)
+    m_spans.push_back({ 0, vertexCount, -1 });
+
+  // ...then one span per chunk
+  for (int c = 0; c < data.chunks().size(); ++c) {
+    const GLData::Chunk &chunk = data.chunks()[c];
+    if (chunk.lineVertexCount == 0)
+      continue;
+
+    const int first = m_vertices.size() / vertexSize;
+    for (int l = chunk.firstLineVertex / 2; l < (chunk.firstLineVertex + chunk.lineVertexCount) / 2; ++l)
+      addSegment(data, l, DataLines);
+
+    m_spans.push_back({ first, m_vertices.size() / vertexSize - first, c });
+  }
+}
+
+void GLLines::takeData(const GLLines &prepared) {
+  m_vertices = prepared.m_vertices;
+  m_spans = prepared.m_spans;
+}
+
+void GLLines::addSegment(const GLData &data, int line, Category category) {
+  const GLfloat *a = data.lineConstData() + 2 * 6 * line;
+  const GLfloat *b = a + 6;
+  const GLfloat width = data.lineWidth(line);
+
+  // the corners: end (0: a, 1: b) and side (left: 1, right: -1) in the direction from a to b
+  auto addCorner = [&](int end, GLfloat side) {
+    const GLfloat *pos = end == 0 ? a : b;
+    const GLfloat *other = end == 0 ? b : a;
+
+    m_vertices << pos[0] << pos[1] << pos[2]
+               << other[0] << other[1] << other[2]
+               << pos[3] << pos[4] << pos[5]
+               << width << side << GLfloat(category) << GLfloat(end);
+  };
+
+  addCorner(0, 1);
+  addCorner(0, -1);
+  addCorner(1, -1);
+
+  addCorner(0, 1);
+  addCorner(1, -1);
+  addCorner(1, 1);
+}
+
+
+
+void GLLines::initializeGL() {
+  initializeOpenGLFunctions();
+
+  if (!m_vbo.create())
+    std::cerr << "ERROR: failed to create line buffer" << std::endl;
+}
+
+void GLLines::destroyGL() {
+  m_vbo.destroy();
+}
+
+
+void GLLines::upload() {
+  m_vbo.bind();
+  m_vbo.allocate(m_vertices.constData(), m_vertices.size() * sizeof(GLfloat));
+  m_vbo.release();
+}
+
+void GLLines::setupVertexAttribs() {
+  m_vbo.bind();
+
+  const int stride = vertexSize * sizeof(GLfloat);
+
+  glEnableVertexAttribArray(VertexAttrib);
+  glEnableVertexAttribArray(OtherAttrib);
+  glEnableVertexAttribArray(ColorAttrib);
+  glEnableVertexAttribArray(ParamsAttrib);
+
+  glVertexAttribPointer(VertexAttrib, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+  glVertexAttribPointer(OtherAttrib, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(3 * sizeof(GLfloat)));
+  glVertexAttribPointer(ColorAttrib, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(6 * sizeof(GLfloat)));
+  glVertexAttribPointer(ParamsAttrib, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(9 * sizeof(GLfloat)));
+
+  m_vbo.release();
+}
+
+
+void GLLines::draw(const Span &span) {
+  if (span.vertexCount > 0)
+    glDrawArrays(GL_TRIANGLES, span.firstVertex, span.vertexCount);
+}
@@ -0,0 +1,77 @@
+#ifndef GLLINES_H
+#define GLLINES_H
+
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+
+#include "gldata.h"
+
+
+/**
+ * Wide lines without glLineWidth, which core profiles and many drivers clamp
+ * to 1 pixel: every segment is a quad of two triangles that the line shader
+ * expands in screen space to the segment's width in pixels.
+ *
+ * The data lines, grid and axes are in one buffer and drawn with one draw
+ * call, plus one per chunk. Categories are hidden in the shader, so toggling
+ * the grid or axes doesn't split the draw.
+ */
+class GLLines : protected QOpenGLFunctions
+{
+public:
+  // vertex attribute locations of the line program
+  enum Attrib {
+    VertexAttrib  = 0,    // this end of the segment
+    OtherAttrib   = 1,    // the other end
+    ColorAttrib   = 2,
+    ParamsAttrib  = 3     // width in pixels, side, category, end
+  };
+
+  // which part of the scene a line belongs to; can be hidden per view
+  enum Category {
+    DataLines,
+    GridLines,
+    AxesLines
+  };
+
+  // consecutive quad vertices in the same chunk of the data, drawn with the same matrix
+  struct Span {
+    int firstVertex;
+    int vertexCount;
+    int chunk;        // GLData::chunks() index, -1 if not in a chunk
+  };
+
+  GLLines();
+
+  // CPU side, may be called without a current context; the grid and axes
+  // are the data lines from gridVertexIdx and axesVertexIdx on
+  void setData(const GLData &data, int gridVertexIdx, int axesVertexIdx);
+
+  // copy the CPU side of lines prepared elsewhere; the next upload() fills the buffer
+  void takeData(const GLLines &prepared);
+
+  // the lines not in a chunk, including grid and axes, come first
+  const QVector<Span> &spans() const              { return m_spans; }
+
+  // GPU side, the context has to be current
+  void initializeGL();
+  void destroyGL();
+
+  void upload();
+
+  // setup the attributes in the currently bound line VAO
+  void setupVertexAttribs();
+
+  void draw(const Span &span);
+
+private:
+  void addSegment(const GLData &data, int line, Category category);
+
+  // 6 vertices per segment: position, other end, color, params
+  QVector<GLfloat> m_vertices;
+  QVector<Span> m_spans;
+
+  QOpenGLBuffer m_vbo;
+};
+
+#endif  // GLLINES_H
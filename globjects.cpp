@@ -0,0 +1,667 @@
+#include "globjects.h"
+#include "shadermanager.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+
+#if !defined(QT_OPENGL_ES_2)
+#include <QOpenGLFunctions_4_3_Core>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <iostream>
+
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_ATOMIC_COUNTER_BUFFER
+#define GL_ATOMIC_COUNTER_BUFFER 0x92C0
+#endif
+#ifndef GL_PARAMETER_BUFFER_ARB
+#define GL_PARAMETER_BUFFER_ARB 0x80EE
+#endif
+
+// work group size of the culling compute shader
+static const int cullGroupSize = 64;
+
+
+static const GLfloat identity[16] = { 1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1 };
+static const GLfloat noTint[4] = { 1, 1, 1, 1 };
+
+
+GLObjects::GLObjects()
+  : m_spanBoundsDirty(true),
+    m_dataDirtyFirst(std::numeric_limits<int>::max()),
+    m_dataDirtyLast(-1),
+    m_commandsDirtyFirst(std::numeric_limits<int>::max()),
+    m_commandsDirtyLast(-1),
+    m_objectVbo(QOpenGLBuffer::VertexBuffer),
+    m_indirectBuffers{ 0, 0 },
+    m_multiDrawIndirect(false),
+    m_cullProgram(nullptr),
+    m_glMultiDrawArraysIndirectCount(nullptr),
+    m_boundsBuffer(0),
+    m_chunksBuffer(0),
+    m_culledBuffers{ 0, 0 },
+    m_counterBuffers{ 0, 0 },
+    m_culledObjectVbo(QOpenGLBuffer::VertexBuffer)
+{
+  setData(GLData());
+}
+
+
+void GLObjects::setData(const GLData &data) {
+  if (data.openObject() != nullptr)
+    std::cerr << "WARNING: object " << data.openObject()->name.toStdString() << " never closed with endObject(), ignored" << std::endl;
+
+  ObjectData initial;
+  std::memcpy(initial.model, identity, sizeof(identity));
+  std::memcpy(initial.tint, noTint, sizeof(noTint));
+
+  m_objectData.clear();
+  m_objectCommand.clear();
+  m_index.clear();
+  m_commands[Opaque].clear();
+  m_commands[Transparent].clear();
+  m_visible.clear();
+  m_transparentCount = 0;
+
+  m_objectData.push_back(initial);
+  m_objectCommand.push_back(-1);
+
+  auto addCommand = [this](int first, int count, int slot) {
+    m_commands[Opaque].push_back({ GLuint(count), 1, GLuint(first), GLuint(slot) });
+    m_commands[Transparent].push_back({ GLuint(count), 0, GLuint(first), GLuint(slot) });
+    m_visible.push_back(true);
+  };
+
+  // chunk boundaries, so that every command lies within one chunk or none
+  QVector<int> bounds;
+  for (const GLData::Chunk &chunk : data.chunks())
+    bounds << chunk.firstVertex << chunk.firstVertex + chunk.vertexCount;
+
+  // triangles between the objects are drawn with slot 0
+  int next = 0;
+  auto addLoose = [&addCommand, &bounds](int first, int end) {
+    for (auto b = std::upper_bound(bounds.cbegin(), bounds.cend(), first); b != bounds.cend() && *b < end; ++b) {
+      addCommand(first, *b - first, 0);
+      first = *b;
+    }
+
+    if (end > first)
+      addCommand(first, end - first, 0);
+  };
+
+  for (const GLData::Object &object : data.objects()) {
+    addLoose(next, object.firstVertex);
+
+    int slot = m_objectData.size();
+    m_index.insert(object.name, slot - 1);
+    m_objectData.push_back(initial);
+    m_objectCommand.push_back(m_visible.size());
+    addCommand(object.firstVertex, object.vertexCount, slot);
+
+    next = object.firstVertex + object.vertexCount;
+  }
+
+  addLoose(next, data.triangleVertexCount());
+
+  // group the commands by chunk
+  const QVector<GLData::Chunk> &chunks = data.chunks();
+  m_spans.clear();
+
+  int c = 0;
+  for (int cmd = 0; cmd < m_visible.size(); ++cmd) {
+    const int first = m_commands[Opaque][cmd].first;
+
+    while (c < chunks.size() && chunks[c].firstVertex + chunks[c].vertexCount <= first)
+      ++c;
+
+    const int chunk = (c < chunks.size() && chunks[c].firstVertex <= first) ? c : -1;
+
+    if (m_spans.isEmpty() || m_spans.last().chunk != chunk)
+      m_spans.push_back({ cmd, 0, chunk });
+
+    ++m_spans.last().commandCount;
+  }
+
+  // bounding boxes for GPU culling
+  m_bounds.clear();
+  m_chunkOrigins.clear();
+
+  for (const Span &span : m_spans) {
+    for (int cmd = span.firstCommand; cmd < span.firstCommand + span.commandCount; ++cmd) {
+      const DrawCommand &command = m_commands[Opaque][cmd];
+      CommandBounds bounds = { { 0, 0, 0 }, span.chunk, { 0, 0, 0 }, 0 };
+
+      for (GLuint v = command.first; v < command.first + command.count; ++v) {
+        const GLfloat *pos = data.triangleConstData() + 6 * v;
+        for (int i = 0; i < 3; ++i) {
+          bounds.min[i] = v == command.first ? pos[i] : std::min(bounds.min[i], pos[i]);
+          bounds.max[i] = v == command.first ? pos[i] : std::max(bounds.max[i], pos[i]);
+        }
+      }
+
+      m_bounds.push_back(bounds);
+    }
+  }
+
+  for (const GLData::Chunk &chunk : chunks)
+    m_chunkOrigins.push_back(splitOrigin(chunk.origin));
+
+  m_spanBoundsDirty = true;
+
+  // everything is uploaded by the next upload()
+  m_dataDirtyFirst = m_commandsDirtyFirst = std::numeric_limits<int>::max();
+  m_dataDirtyLast = m_commandsDirtyLast = -1;
+}
+
+void GLObjects::takeData(const GLObjects &prepared) {
+  m_objectData = prepared.m_objectData;
+  m_objectCommand = prepared.m_objectCommand;
+  m_index = prepared.m_index;
+  m_commands[Opaque] = prepared.m_commands[Opaque];
+  m_commands[Transparent] = prepared.m_commands[Transparent];
+  m_visible = prepared.m_visible;
+  m_transparentCount = prepared.m_transparentCount;
+  m_spans = prepared.m_spans;
+  m_bounds = prepared.m_bounds;
+  m_chunkOrigins = prepared.m_chunkOrigins;
+
+  m_spanBoundsDirty = true;
+  m_dataDirtyFirst = m_commandsDirtyFirst = std::numeric_limits<int>::max();
+  m_dataDirtyLast = m_commandsDirtyLast = -1;
+}
+
+
+bool GLObjects::checkIndex(int object) const {
+  if (object >= 0 && object < count())
+    return true;
+
+  std::cerr << "WARNING: no object " << object << ", there are " << count() << std::endl;
+  return false;
+}
+
+bool GLObjects::isVisible(int object) const {
+  if (!checkIndex(object))
+    return false;
+
+  return m_visible[m_objectCommand[object + 1]];
+}
+
+QMatrix4x4 GLObjects::transform(int object) const {
+  QMatrix4x4 model;
+  if (checkIndex(object))
+    std::memcpy(model.data(), m_objectData[object + 1].model, sizeof(identity));
+  return model;
+}
+
+QVector4D GLObjects::tint(int object) const {
+  if (!checkIndex(object))
+    return QVector4D(noTint[0], noTint[1], noTint[2], noTint[3]);
+
+  const GLfloat *t = m_objectData[object + 1].tint;
+  return QVector4D(t[0], t[1], t[2], t[3]);
+}
+
+bool GLObjects::setVisible(int object, bool visible) {
+  if (!checkIndex(object))
+    return false;
+
+  int cmd = m_objectCommand[object + 1];
+  m_visible[cmd] = visible;
+  updateCommand(cmd);
+  return true;
+}
+
+bool GLObjects::setTransform(int object, const QMatrix4x4 &model) {
+  if (!checkIndex(object))
+    return false;
+
+  std::memcpy(m_objectData[object + 1].model, model.constData(), sizeof(identity));
+  markDirty(m_dataDirtyFirst, m_dataDirtyLast, object + 1);
+  m_spanBoundsDirty = true;
+  return true;
+}
+
+bool GLObjects::setTint(int object, const QVector4D &tint) {
+  if (!checkIndex(object))
+    return false;
+
+  GLfloat *t = m_objectData[object + 1].tint;
+  t[0] = tint.x();
+  t[1] = tint.y();
+  t[2] = tint.z();
+  t[3] = tint.w();
+  markDirty(m_dataDirtyFirst, m_dataDirtyLast, object + 1);
+
+  // the opacity decides the pass
+  updateCommand(m_objectCommand[object + 1]);
+  return true;
+}
+
+void GLObjects::updateCommand(int cmd) {
+  const bool transparent = m_objectData[m_commands[Opaque][cmd].baseInstance].tint[3] < 1;
+  const GLuint wasTransparent = m_commands[Transparent][cmd].instanceCount;
+
+  m_commands[Opaque][cmd].instanceCount = m_visible[cmd] && !transparent ? 1 : 0;
+  m_commands[Transparent][cmd].instanceCount = m_visible[cmd] && transparent ? 1 : 0;
+
+  m_transparentCount += int(m_commands[Transparent][cmd].instanceCount) - int(wasTransparent);
+  markDirty(m_commandsDirtyFirst, m_commandsDirtyLast, cmd);
+}
+
+GLObjects::Box GLObjects::transformedBounds(int cmd) const {
+  const CommandBounds &bounds = m_bounds[cmd];
+  const GLfloat *m = m_objectData[m_commands[Opaque][cmd].baseInstance].model;
+
+  // the box around the moved box: the center is moved, the extent spread by the absolute matrix
+  const QVector3D center = 0.5f * (QVector3D(bounds.min[0], bounds.min[1], bounds.min[2]) + QVector3D(bounds.max[0], bounds.max[1], bounds.max[2]));
+  const QVector3D extent = 0.5f * (QVector3D(bounds.max[0], bounds.max[1], bounds.max[2]) - QVector3D(bounds.min[0], bounds.min[1], bounds.min[2]));
+
+  QVector3D movedCenter, movedExtent;
+  for (int i = 0; i < 3; ++i) {
+    // column-major
+    movedCenter[i] = m[i] * center[0] + m[4 + i] * center[1] + m[8 + i] * center[2] + m[12 + i];
+    movedExtent[i] = std::abs(m[i]) * extent[0] + std::abs(m[4 + i]) * extent[1] + std::abs(m[8 + i]) * extent[2];
+  }
+
+  return { movedCenter - movedExtent, movedCenter + movedExtent };
+}
+
+bool GLObjects::isClipped(const Box &box, const QVector<QVector4D> &clipPlanes) {
+  for (const QVector4D &plane : clipPlanes) {
+    // the corner furthest on the inner side
+    const QVector3D corner(plane.x() >= 0 ? box.max.x() : box.min.x(),
+                           plane.y() >= 0 ? box.max.y() : box.min.y(),
+                           plane.z() >= 0 ? box.max.z() : box.min.z());
+
+    if (QVector3D::dotProduct(plane.toVector3D(), corner) + plane.w() < 0)
+      return true;
+  }
+
+  return false;
+}
+
+GLObjects::Box GLObjects::transformedBounds(const Span &span) const {
+  Box box = transformedBounds(span.firstCommand);
+
+  for (int cmd = span.firstCommand + 1; cmd < span.firstCommand + span.commandCount; ++cmd) {
+    const Box b = transformedBounds(cmd);
+    for (int i = 0; i < 3; ++i) {
+      box.min[i] = std::min(box.min[i], b.min[i]);
+      box.max[i] = std::max(box.max[i], b.max[i]);
+    }
+  }
+
+  return box;
+}
+
+bool GLObjects::isClipped(const Span &span, const QVector<QVector4D> &clipPlanes) {
+  if (span.commandCount == 0)
+    return true;
+
+  // the bounds of the spans are cached until an object moves
+  if (m_spanBoundsDirty) {
+    m_spanBoundsDirty = false;
+    m_spanBounds.clear();
+
+    for (const Span &s : m_spans)
+      m_spanBounds.push_back(transformedBounds(s));
+  }
+
+  auto it = std::lower_bound(m_spans.cbegin(), m_spans.cend(), span.firstCommand,
+                             [](const Span &s, int first) { return s.firstCommand < first; });
+
+  if (it != m_spans.cend() && it->firstCommand == span.firstCommand && it->commandCount == span.commandCount)
+    return isClipped(m_spanBounds[it - m_spans.cbegin()], clipPlanes);
+
+  return isClipped(transformedBounds(span), clipPlanes);
+}
+
+void GLObjects::markDirty(int &first, int &last, int idx) {
+  first = std::min(first, idx);
+  last = std::max(last, idx);
+}
+
+QOpenGLFunctions_4_3_Core *GLObjects::gl43() const {
+#if !defined(QT_OPENGL_ES_2)
+  // created once per context by Qt, initializing it again returns right away
+  QOpenGLFunctions_4_3_Core *gl = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_3_Core>();
+  if (gl != nullptr && gl->initializeOpenGLFunctions())
+    return gl;
+#endif
+  return nullptr;
+}
+
+
+
+void GLObjects::initializeGL() {
+  initializeOpenGLFunctions();
+
+  // multi draw indirect with baseInstance needs OpenGL 4.3
+  QOpenGLContext *ctx = QOpenGLContext::currentContext();
+  m_multiDrawIndirect = !ctx->isOpenGLES() && ctx->format().version() >= qMakePair(4, 3);
+  m_multiDrawIndirect = m_multiDrawIndirect && gl43() != nullptr;
+
+  if (!m_multiDrawIndirect)
+    return;
+
+  if (!m_objectVbo.create())
+    std::cerr << "ERROR: failed to create object buffer" << std::endl;
+
+  glGenBuffers(2, m_indirectBuffers);
+
+  // GPU culling, optional
+  m_cullProgram = ShaderManager::instance()->program(ShaderManager::CullCommands);
+  if (m_cullProgram == nullptr)
+    return;
+
+  m_glMultiDrawArraysIndirectCount = nullptr;
+  if (ctx->format().version() >= qMakePair(4, 6))
+    m_glMultiDrawArraysIndirectCount = reinterpret_cast<MultiDrawArraysIndirectCount>(ctx->getProcAddress("glMultiDrawArraysIndirectCount"));
+  else if (ctx->hasExtension("GL_ARB_indirect_parameters"))
+    m_glMultiDrawArraysIndirectCount = reinterpret_cast<MultiDrawArraysIndirectCount>(ctx->getProcAddress("glMultiDrawArraysIndirectCountARB"));
+
+  if (!m_culledObjectVbo.create())
+    std::cerr << "ERROR: failed to create culled object buffer" << std::endl;
+
+  glGenBuffers(1, &m_boundsBuffer);
+  glGenBuffers(1, &m_chunksBuffer);
+  glGenBuffers(2, m_culledBuffers);
+  glGenBuffers(2, m_counterBuffers);
+}
+
+void GLObjects::destroyGL() {
+  m_objectVbo.destroy();
+
+  if (m_indirectBuffers[0] != 0) {
+    glDeleteBuffers(2, m_indirectBuffers);
+    m_indirectBuffers[0] = m_indirectBuffers[1] = 0;
+  }
+
+  m_culledObjectVbo.destroy();
+
+  if (m_boundsBuffer != 0) {
+    glDeleteBuffers(1, &m_boundsBuffer);
+    glDeleteBuffers(1, &m_chunksBuffer);
+    glDeleteBuffers(2, m_culledBuffers);
+    glDeleteBuffers(2, m_counterBuffers);
+    m_boundsBuffer = m_chunksBuffer = 0;
+    m_culledBuffers[0] = m_culledBuffers[1] = 0;
+    m_counterBuffers[0] = m_counterBuffers[1] = 0;
+  }
+
+  m_cullProgram = nullptr;
+}
+
+
+void GLObjects::upload() {
+  m_dataDirtyFirst = m_commandsDirtyFirst = std::numeric_limits<int>::max();
+  m_dataDirtyLast = m_commandsDirtyLast = -1;
+
+  // without multi draw indirect, the CPU copy is all we need
+  if (!m_multiDrawIndirect)
+    return;
+
+  m_objectVbo.bind();
+  m_objectVbo.allocate(m_objectData.constData(), m_objectData.size() * sizeof(ObjectData));
+  m_objectVbo.release();
+
+  for (int pass : { Opaque, Transparent }) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffers[pass]);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, m_commands[pass].size() * sizeof(DrawCommand), m_commands[pass].constData(), GL_DYNAMIC_DRAW);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  if (!gpuCulling())
+    return;
+
+  // inputs of the culling shader
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_boundsBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, m_bounds.size() * sizeof(CommandBounds), m_bounds.constData(), GL_STATIC_DRAW);
+
+  // the buffer can't be empty, it's bound even without chunks
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_chunksBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, m_chunkOrigins.size()) * sizeof(ChunkOrigin), m_chunkOrigins.constData(), GL_STATIC_DRAW);
+
+  // its outputs: without the count, all commands are drawn, so they start out as empty draws
+  // rather than whatever the buffer holds, should a cull ever not write them
+  const QVector<DrawCommand> empty(m_bounds.size(), DrawCommand{ 0, 0, 0, 0 });
+  for (int pass : { Opaque, Transparent }) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_culledBuffers[pass]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, empty.size() * sizeof(DrawCommand), empty.constData(), GL_DYNAMIC_COPY);
+
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_counterBuffers[pass]);
+    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+  m_culledObjectVbo.bind();
+  m_culledObjectVbo.allocate(m_bounds.size() * sizeof(ObjectData));
+  m_culledObjectVbo.release();
+}
+
+void GLObjects::uploadDirty() {
+  if (!m_multiDrawIndirect)
+    return;
+
+  if (m_dataDirtyFirst <= m_dataDirtyLast) {
+    m_objectVbo.bind();
+    m_objectVbo.write(m_dataDirtyFirst * sizeof(ObjectData), &m_objectData[m_dataDirtyFirst],
+                      (m_dataDirtyLast - m_dataDirtyFirst + 1) * sizeof(ObjectData));
+    m_objectVbo.release();
+  }
+
+  if (m_commandsDirtyFirst <= m_commandsDirtyLast) {
+    for (int pass : { Opaque, Transparent }) {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffers[pass]);
+      glBufferSubData(GL_DRAW_INDIRECT_BUFFER, m_commandsDirtyFirst * sizeof(DrawCommand),
+                      (m_commandsDirtyLast - m_commandsDirtyFirst + 1) * sizeof(DrawCommand), &m_commands[pass][m_commandsDirtyFirst]);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  }
+
+  m_dataDirtyFirst = m_commandsDirtyFirst = std::numeric_limits<int>::max();
+  m_dataDirtyLast = m_commandsDirtyLast = -1;
+}
+
+
+void GLObjects::setupVertexAttribs() {
+  // without multi draw indirect, the per-object data is set as constant attributes in draw()
+  if (!m_multiDrawIndirect)
+    return;
+
+  setupInstanceAttribs(m_objectVbo);
+}
+
+void GLObjects::setupCulledVertexAttribs() {
+  if (gpuCulling())
+    setupInstanceAttribs(m_culledObjectVbo);
+}
+
+void GLObjects::setupInstanceAttribs(QOpenGLBuffer &buffer) {
+#if !defined(QT_OPENGL_ES_2)
+  QOpenGLFunctions_4_3_Core *gl = gl43();
+  buffer.bind();
+
+  // a mat4 attribute is four vec4 columns
+  for (int c = 0; c < 4; ++c) {
+    glEnableVertexAttribArray(ModelAttrib + c);
+    glVertexAttribPointer(ModelAttrib + c, 4, GL_FLOAT, GL_FALSE, sizeof(ObjectData),
+                          reinterpret_cast<void *>(offsetof(ObjectData, model) + c * 4 * sizeof(GLfloat)));
+    gl->glVertexAttribDivisor(ModelAttrib + c, 1);
+  }
+
+  glEnableVertexAttribArray(TintAttrib);
+  glVertexAttribPointer(TintAttrib, 4, GL_FLOAT, GL_FALSE, sizeof(ObjectData),
+                        reinterpret_cast<void *>(offsetof(ObjectData, tint)));
+  gl->glVertexAttribDivisor(TintAttrib, 1);
+
+  buffer.release();
+#else
+  Q_UNUSED(buffer);
+#endif
+}
+
+
+void GLObjects::draw(Pass pass) {
+  draw(pass, { 0, m_visible.size(), -1 });
+}
+
+void GLObjects::draw(Pass pass, const Span &span, const QVector<QVector4D> &clipPlanes) {
+  const QVector<DrawCommand> &commands = m_commands[pass];
+
+  if (span.commandCount == 0 || (pass == Transparent && !hasTransparent()))
+    return;
+
+#if !defined(QT_OPENGL_ES_2)
+  if (m_multiDrawIndirect) {
+    uploadDirty();
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffers[pass]);
+    gl43()->glMultiDrawArraysIndirect(GL_TRIANGLES, reinterpret_cast<void *>(span.firstCommand * sizeof(DrawCommand)),
+                                      span.commandCount, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return;
+  }
+#endif
+
+  // fallback: one draw per visible range
+  for (int i = span.firstCommand; i < span.firstCommand + span.commandCount; ++i) {
+    const DrawCommand &cmd = commands[i];
+    if (cmd.instanceCount == 0 || cmd.count == 0)
+      continue;
+
+    if (!clipPlanes.isEmpty() && isClipped(transformedBounds(i), clipPlanes))
+      continue;
+
+    setVertexAttribs(m_objectData[cmd.baseInstance]);
+    glDrawArrays(GL_TRIANGLES, cmd.first, cmd.count);
+  }
+
+  resetVertexAttribs();
+}
+
+
+void GLObjects::setVertexAttribs(const ObjectData &object) {
+  for (int c = 0; c < 4; ++c)
+    glVertexAttrib4fv(ModelAttrib + c, object.model + 4 * c);
+
+  glVertexAttrib4fv(TintAttrib, object.tint);
+}
+
+void GLObjects::cull(Pass pass, const QMatrix4x4 &viewProjection, const DVector3 &cameraPosition,
+                     const QVector<QVector4D> &clipPlanes) {
+#if !defined(QT_OPENGL_ES_2)
+  if (!gpuCulling() || m_bounds.isEmpty())
+    return;
+
+  uploadDirty();
+  QOpenGLFunctions_4_3_Core *gl = gl43();
+
+  const GLuint zero = 0;
+  glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_counterBuffers[pass]);
+  glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+  glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+  gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_indirectBuffers[pass]);
+  gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_objectVbo.bufferId());
+  gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_boundsBuffer);
+  gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_chunksBuffer);
+  gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_culledBuffers[pass]);
+  gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_culledObjectVbo.bufferId());
+  gl->glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, m_counterBuffers[pass]);
+
+  const ChunkOrigin camera = splitOrigin(cameraPosition);
+
+  m_cullProgram->bind();
+  m_cullProgram->setUniformValue("viewProjection", viewProjection);
+  m_cullProgram->setUniformValue("cameraHigh", QVector3D(camera.high[0], camera.high[1], camera.high[2]));
+  m_cullProgram->setUniformValue("cameraLow", QVector3D(camera.low[0], camera.low[1], camera.low[2]));
+  m_cullProgram->setUniformValue("commandCount", GLint(m_bounds.size()));
+  m_cullProgram->setUniformValue("compact", GLint(m_glMultiDrawArraysIndirectCount != nullptr));
+  m_cullProgram->setUniformValueArray("clipPlanes", clipPlanes.constData(), std::min(clipPlanes.size(), int(maxClipPlanes)));
+  m_cullProgram->setUniformValue("clipPlaneCount", std::min(clipPlanes.size(), int(maxClipPlanes)));
+
+  gl->glDispatchCompute((m_bounds.size() + cullGroupSize - 1) / cullGroupSize, 1, 1);
+  m_cullProgram->release();
+
+  // the commands, per-object data and count are read by the draw, the counter is reset by the next cull
+  gl->glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+#else
+  Q_UNUSED(pass);
+  Q_UNUSED(viewProjection);
+  Q_UNUSED(cameraPosition);
+  Q_UNUSED(clipPlanes);
+#endif
+}
+
+void GLObjects::drawCulled(Pass pass) {
+#if !defined(QT_OPENGL_ES_2)
+  if (!gpuCulling() || m_bounds.isEmpty() || (pass == Transparent && !hasTransparent()))
+    return;
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_culledBuffers[pass]);
+
+  if (m_glMultiDrawArraysIndirectCount != nullptr) {
+    // packed, as many as counted
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, m_counterBuffers[pass]);
+    m_glMultiDrawArraysIndirectCount(GL_TRIANGLES, nullptr, 0, m_bounds.size(), 0);
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+  } else {
+    gl43()->glMultiDrawArraysIndirect(GL_TRIANGLES, nullptr, m_bounds.size(), 0);
+  }
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+#else
+  Q_UNUSED(pass);
+#endif
+}
+
+int GLObjects::culledCount(Pass pass) {
+  if (!gpuCulling() || m_bounds.isEmpty())
+    return -1;
+
+  GLuint count = 0;
+#if !defined(QT_OPENGL_ES_2)
+  glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_counterBuffers[pass]);
+  gl43()->glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &count);
+  glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+#else
+  Q_UNUSED(pass);
+#endif
+  return int(count);
+}
+
+
+GLObjects::ChunkOrigin GLObjects::splitOrigin(const DVector3 &origin) {
+  // high + low is the origin in about 48 bits of precision
+  ChunkOrigin split;
+  const double coords[3] = { origin.x, origin.y, origin.z };
+
+  for (int i = 0; i < 3; ++i) {
+    split.high[i] = GLfloat(coords[i]);
+    split.low[i] = GLfloat(coords[i] - double(split.high[i]));
+  }
+  split.high[3] = split.low[3] = 0;
+
+  return split;
+}
+
+
+void GLObjects::resetVertexAttribs() {
+  for (int c = 0; c < 4; ++c)
+    glVertexAttrib4fv(ModelAttrib + c, identity + 4 * c);
+
+  glVertexAttrib4fv(TintAttrib, noTint);
+}
@@ -0,0 +1,243 @@
+#ifndef GLOBJECTS_H
+#define GLOBJECTS_H
+
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QMatrix4x4>
+#include <QVector4D>
+#include <QHash>
+
+#include "gldata.h"
+
+QT_FORWARD_DECLARE_CLASS(QOpenGLFunctions_4_3_Core)
+QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
+
+
+/**
+ * The object layer: visibility, model matrix and color tint of the named
+ * triangle ranges of a GLData (see GLData::beginObject()).
+ *
+ * With OpenGL 4.3, all objects are drawn with one glMultiDrawArraysIndirect and
+ * the per-object data is read as instanced vertex attributes, the baseInstance
+ * of each draw command being the object. Otherwise, the objects are drawn in a
+ * loop with the per-object data set as constant vertex attributes.
+ *
+ * Either way, changing an object only updates its entry in the object or
+ * command buffer, the triangles are never uploaded again.
+ *
+ * Objects with a tint alpha (opacity) below 1 are translucent and drawn in
+ * a separate pass, opaque objects are never blended.
+ *
+ * GPU culling, also OpenGL 4.3: a compute shader tests the bounding box of
+ * every draw command against the view frustum and writes the visible
+ * commands into a second command buffer, along with the per-object data of
+ * each command moved by the chunk's offset from the camera origin. All
+ * chunks of a pass are then drawn with a single glMultiDrawArraysIndirect,
+ * without any readback. With ARB_indirect_parameters, the visible commands
+ * are packed and counted with an atomic counter that is the draw count;
+ * otherwise culled commands keep their place with an instance count of 0.
+ *
+ * Clip planes are given relative to the origin of the draw's vertices, a
+ * chunk origin or, for GPU culling, the camera position. Spans that are
+ * entirely clipped are up to the caller to skip, see isClipped(); without
+ * multi draw indirect, single commands that are clipped are not drawn, and GPU
+ * culling drops clipped commands as well. Neither changes any buffer.
+ */
+class GLObjects : protected QOpenGLFunctions
+{
+public:
+  // vertex attribute locations of the per-object data
+  enum Attrib {
+    ModelAttrib = 2,    // mat4, uses locations 2 to 5
+    TintAttrib  = 6
+  };
+
+  enum Pass {
+    Opaque,
+    Transparent
+  };
+
+  // the most clip planes of a draw, see QGLViewer::setClipConfig()
+  static const int maxClipPlanes = 12;
+
+  // consecutive commands in the same chunk of the data, drawn with the same matrix
+  struct Span {
+    int firstCommand;
+    int commandCount;
+    int chunk;        // GLData::chunks() index, -1 if not in a chunk
+  };
+
+  GLObjects();
+
+  // CPU side, may be called without a current context
+  void setData(const GLData &data);
+
+  // copy the CPU side of objects prepared elsewhere, e.g. on another thread; the arrays are
+  // implicitly shared, so this is cheap. The buffers stay, the next upload() fills them
+  void takeData(const GLObjects &prepared);
+
+  int count() const                               { return m_objectData.size() - 1; }
+  int indexOf(const QString &name) const          { return m_index.value(name, -1); }
+
+  // objects are 0 to count() - 1; other indices, e.g. -1 from indexOf(), are rejected with a warning
+  bool isVisible(int object) const;
+  QMatrix4x4 transform(int object) const;
+  QVector4D tint(int object) const;
+
+  // false if there is no such object
+  bool setVisible(int object, bool visible);
+  bool setTransform(int object, const QMatrix4x4 &model);
+  bool setTint(int object, const QVector4D &tint);
+
+  const QVector<Span> &spans() const              { return m_spans; }
+  int commandCount() const                        { return m_visible.size(); }
+
+  // any visible translucent objects?
+  bool hasTransparent() const                     { return m_transparentCount > 0; }
+
+  // GPU side, the context has to be current
+  void initializeGL();
+  void destroyGL();
+
+  bool multiDrawIndirect() const                  { return m_multiDrawIndirect; }
+
+  // upload all objects and draw commands
+  void upload();
+
+  // setup the per-object attributes in the currently bound triangle VAO
+  void setupVertexAttribs();
+
+  // draw all visible objects of the pass from the currently bound triangle VAO
+  void draw(Pass pass = Opaque);
+  void draw(Pass pass, const Span &span, const QVector<QVector4D> &clipPlanes = QVector<QVector4D>());   // a span that isn't clipped
+
+  /**
+   * Whether the triangles of the span, moved by their objects' transforms,
+   * are all on the outer side of one of the planes: dot(plane.xyz, p) + plane.w < 0.
+   */
+  bool isClipped(const Span &span, const QVector<QVector4D> &clipPlanes);
+
+  bool gpuCulling() const                         { return m_cullProgram != nullptr; }
+
+  // setup the attributes of a triangle VAO for drawCulled()
+  void setupCulledVertexAttribs();
+
+  /**
+   * Cull the commands of the pass for a camera with the given matrix for
+   * vertices relative to its world position (Camera::toMatrix(position)), then
+   * draw the visible ones from the currently bound culled triangle VAO. The clip
+   * planes are relative to the same position.
+   */
+  void cull(Pass pass, const QMatrix4x4 &viewProjection, const DVector3 &cameraPosition,
+            const QVector<QVector4D> &clipPlanes = QVector<QVector4D>());
+  void drawCulled(Pass pass);
+
+  // the number of commands of the pass that passed the last culling; reads it back, so only for debugging
+  int culledCount(Pass pass);
+
+  // set the per-object attributes to identity for draws that have no objects
+  void resetVertexAttribs();
+
+private:
+  // one object as stored in the object buffer
+  struct ObjectData {
+    GLfloat model[16];  // column-major
+    GLfloat tint[4];
+  };
+
+  // layout of DrawArraysIndirectCommand
+  struct DrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;  // object slot, the command index after culling
+  };
+
+  // bounding box of a command's triangles, std430 layout
+  struct CommandBounds {
+    GLfloat min[3];
+    GLint chunk;          // -1 if not in a chunk
+    GLfloat max[3];
+    GLint padding;
+  };
+
+  // a chunk origin split into two floats per coordinate, high + low
+  struct ChunkOrigin {
+    GLfloat high[4];
+    GLfloat low[4];
+  };
+
+  // an axis-aligned box
+  struct Box {
+    QVector3D min;
+    QVector3D max;
+  };
+
+  // the object exists, or else a warning
+  bool checkIndex(int object) const;
+
+  // recalculate the instance counts of the command in both passes
+  void updateCommand(int cmd);
+
+  // the bounding box of a command moved by the transform of its object, or of all commands of a span
+  Box transformedBounds(int cmd) const;
+  Box transformedBounds(const Span &span) const;
+  static bool isClipped(const Box &box, const QVector<QVector4D> &clipPlanes);
+
+  // the OpenGL 4.3 functions of the current context: they belong to a context, not to the
+  // share group, and the context that created the buffers may be gone
+  QOpenGLFunctions_4_3_Core *gl43() const;
+
+  void setVertexAttribs(const ObjectData &object);
+  void setupInstanceAttribs(QOpenGLBuffer &buffer);
+  void uploadDirty();
+
+  static ChunkOrigin splitOrigin(const DVector3 &origin);
+
+  static void markDirty(int &first, int &last, int idx);
+
+  // slot 0 holds the triangles that are not part of any object,
+  // object i is in slot i + 1
+  QVector<ObjectData> m_objectData;
+  QVector<int> m_objectCommand;
+  QHash<QString, int> m_index;
+
+  // one command list per pass; a command has an instance count of 1 in the
+  // pass its object belongs to if it is visible, 0 otherwise
+  QVector<DrawCommand> m_commands[2];
+  QVector<bool> m_visible;
+  int m_transparentCount;
+
+  QVector<Span> m_spans;
+
+  // the transformed bounding box of each span, for clipping
+  QVector<Box> m_spanBounds;
+  bool m_spanBoundsDirty;
+
+  // dirty ranges, inclusive; first > last if nothing is dirty
+  int m_dataDirtyFirst, m_dataDirtyLast;
+  int m_commandsDirtyFirst, m_commandsDirtyLast;
+
+  QOpenGLBuffer m_objectVbo;
+  GLuint m_indirectBuffers[2];
+
+  bool m_multiDrawIndirect;
+
+  // GPU culling
+  QVector<CommandBounds> m_bounds;
+  QVector<ChunkOrigin> m_chunkOrigins;
+
+  QOpenGLShaderProgram *m_cullProgram;
+
+  typedef void (QOPENGLF_APIENTRYP MultiDrawArraysIndirectCount)(GLenum mode, const void *indirect, GLintptr drawCount,
+                                                                   GLsizei maxDrawCount, GLsizei stride);
+  MultiDrawArraysIndirectCount m_glMultiDrawArraysIndirectCount;
+
+  GLuint m_boundsBuffer;
+  GLuint m_chunksBuffer;
+  GLuint m_culledBuffers[2];    // commands per pass
+  GLuint m_counterBuffers[2];   // visible commands per pass
+  QOpenGLBuffer m_culledObjectVbo;   // per-object data per command, moved by the chunk offset
+};
+
+#endif  // GLOBJECTS_H
@@ -0,0 +1,117 @@
+#include "glpoints.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <random>
+
+
+GLPoints::GLPoints()
+  : m_vbo(QOpenGLBuffer::VertexBuffer)
+{}
+
+
+void GLPoints::setData(GLData &data) {
+  m_spans.clear();
+  if (data.pointCount() == 0)
+    return;
+
+  // always the same order for the same data
+  std::mt19937 random(1);
+  GLData::Point *points = data.pointData();
+
+  // a span from the [first, end) range of the data points
+  auto addSpan = [this, points, &random](int first, int end, int chunk) {
+    if (first >= end)
+      return;
+
+    Span span = { first, end - first, chunk, QVector3D(), QVector3D() };
+    std::shuffle(points + first, points + end, random);
+
+    for (int i = first; i < end; ++i) {
+      const QVector3D pos(points[i].position[0], points[i].position[1], points[i].position[2]);
+      if (i == first)
+        span.min = span.max = pos;
+
+      span.min = QVector3D(std::min(span.min.x(), pos.x()), std::min(span.min.y(), pos.y()), std::min(span.min.z(), pos.z()));
+      span.max = QVector3D(std::max(span.max.x(), pos.x()), std::max(span.max.y(), pos.y()), std::max(span.max.z(), pos.z()));
+    }
+
+    m_spans.push_back(span);
+  };
+
+  // the points between the chunks, each range a span of its own
+  int next = 0;
+  for (const GLData::Chunk &chunk : data.chunks()) {
+    addSpan(next, chunk.firstPoint, -1);
+    next = chunk.firstPoint + chunk.pointCount;
+  }
+  addSpan(next, data.pointCount(), -1);
+
+  for (int c = 0; c < data.chunks().size(); ++c) {
+    const GLData::Chunk &chunk = data.chunks()[c];
+    addSpan(chunk.firstPoint, chunk.firstPoint + chunk.pointCount, c);
+  }
+}
+
+
+float GLPoints::density(const Span &span, const QVector3D &camera, float fullDensityDistance, float minDensity) {
+  if (fullDensityDistance <= 0)
+    return 1;
+
+  // distance from the camera to the bounding box, 0 inside
+  const QVector3D outside(std::max({ span.min.x() - camera.x(), 0.0f, camera.x() - span.max.x() }),
+                          std::max({ span.min.y() - camera.y(), 0.0f, camera.y() - span.max.y() }),
+                          std::max({ span.min.z() - camera.z(), 0.0f, camera.z() - span.max.z() }));
+  const float distance = outside.length();
+
+  if (distance <= fullDensityDistance)
+    return 1;
+
+  // the projected area of the span shrinks with the square of the distance
+  const float ratio = fullDensityDistance / distance;
+  return std::max(ratio * ratio, minDensity);
+}
+
+
+
+void GLPoints::initializeGL() {
+  initializeOpenGLFunctions();
+
+  if (!m_vbo.create())
+    std::cerr << "ERROR: failed to create point buffer" << std::endl;
+}
+
+void GLPoints::destroyGL() {
+  m_vbo.destroy();
+}
+
+
+void GLPoints::upload(const GLData &data) {
+  m_vbo.bind();
+  m_vbo.allocate(data.pointConstData(), data.pointCount() * sizeof(GLData::Point));
+  m_vbo.release();
+}
+
+void GLPoints::setupVertexAttribs() {
+  m_vbo.bind();
+
+  glEnableVertexAttribArray(VertexAttrib);
+  glEnableVertexAttribArray(ColorAttrib);
+
+  glVertexAttribPointer(VertexAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(GLData::Point),
+                        reinterpret_cast<void *>(offsetof(GLData::Point, position)));
+  glVertexAttribPointer(ColorAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GLData::Point),
+                        reinterpret_cast<void *>(offsetof(GLData::Point, color)));
+
+  m_vbo.release();
+}
+
+
+void GLPoints::draw(const Span &span, float density) {
+  // shuffled, so the first points are a uniform subsample
+  const int count = std::min(span.pointCount, int(std::ceil(span.pointCount * density)));
+  if (count > 0)
+    glDrawArrays(GL_POINTS, span.firstPoint, count);
+}
@@ -0,0 +1,79 @@
+#ifndef GLPOINTS_H
+#define GLPOINTS_H
+
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QVector3D>
+
+#include "gldata.h"
+
+
+/**
+ * The point clouds of a GLData in their own buffer, drawn as point sprites
+ * of a fixed size in pixels.
+ *
+ * The points of each span (each range of points outside of chunks, and each
+ * chunk) are shuffled in place in the data, so that any prefix of a span is
+ * a uniform subsample of it; there is no further copy on the CPU.
+ * Distant spans are drawn with only such a prefix, and larger sprites to
+ * cover the same area, which keeps clouds of many millions of points
+ * interactive.
+ */
+class GLPoints : protected QOpenGLFunctions
+{
+public:
+  // vertex attribute locations of the point program
+  enum Attrib {
+    VertexAttrib  = 0,
+    ColorAttrib   = 1     // normalized unsigned bytes
+  };
+
+  // a range of points outside of chunks, or those of one chunk
+  struct Span {
+    int firstPoint;
+    int pointCount;
+    int chunk;        // GLData::chunks() index, -1 if not in a chunk
+
+    // bounding box, relative to the chunk origin
+    QVector3D min;
+    QVector3D max;
+  };
+
+  GLPoints();
+
+  // CPU side, may be called without a current context; shuffles the points of the data
+  void setData(GLData &data);
+
+  // copy the CPU side of points prepared elsewhere, for their shuffled data
+  void takeData(const GLPoints &prepared)        { m_spans = prepared.m_spans; }
+
+  const QVector<Span> &spans() const              { return m_spans; }
+
+  /**
+   * The fraction of the span's points to draw for a camera at the given
+   * position (relative to the chunk origin): all of them up to fullDensityDistance
+   * from the bounding box, then falling off with the square of the distance,
+   * but not below minDensity. A fullDensityDistance of 0 draws all points.
+   */
+  static float density(const Span &span, const QVector3D &camera, float fullDensityDistance, float minDensity);
+
+  // GPU side, the context has to be current
+  void initializeGL();
+  void destroyGL();
+
+  // the points of the data given to setData()
+  void upload(const GLData &data);
+
+  // setup the attributes in the currently bound point VAO
+  void setupVertexAttribs();
+
+  // draw the given fraction of the span's points
+  void draw(const Span &span, float density = 1);
+
+private:
+  QVector<Span> m_spans;
+
+  QOpenGLBuffer m_vbo;
+};
+
+#endif  // GLPOINTS_H
@@ -0,0 +1,511 @@
+#include "glscene.h"
+#include "sceneedit.h"
+
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+
+#include <iostream>
+
+
+// grid config defaults
+GridConfig::GridConfig()
+  : minX(-2000), maxX(2000),
+    minY(-2000), maxY(2000),
+    step(100),
+    color(QVector3D(0.7f, 0.7f, 0.7f)),
+    lineWidth(0.5f)
+{}
+
+// axes config defaults
+AxesConfig::AxesConfig()
+  : length(250.0f),
+    arrowSize(10.0f),
+    colorX(QVector3D(1, 0, 0)),
+    colorY(QVector3D(0, 1, 0)),
+    colorZ(QVector3D(0, 0, 1)),
+    lineWidth(3)
+{}
+
+
+bool GLScene::Setup::operator==(const Setup &other) const {
+  return grid.minX == other.grid.minX && grid.maxX == other.grid.maxX
+      && grid.minY == other.grid.minY && grid.maxY == other.grid.maxY && grid.step == other.grid.step
+      && grid.color == other.grid.color && grid.lineWidth == other.grid.lineWidth
+      && axes.length == other.axes.length && axes.arrowSize == other.axes.arrowSize
+      && axes.colorX == other.axes.colorX && axes.colorY == other.axes.colorY && axes.colorZ == other.axes.colorZ
+      && axes.lineWidth == other.axes.lineWidth
+      && font == other.font;
+}
+
+
+GLScene::Content::Content()
+  : gridVertexIdx(-1),
+    gridLabelIdx(-1),
+    axesVertexIdx(-1),
+    axesLabelIdx(-1)
+{}
+
+void GLScene::Content::setData(const GLData &d) {
+  data = d;
+  objects.setData(data);
+
+  // shuffled in our copy, which shares nothing with the caller's anymore if it still has one
+  points.setData(data);
+
+  // per vertex: its corner of the triangle, and the edges to hide in feature edge mode
+  const int triangleCount = data.triangleVertexCount() / 3;
+  edges.fill(0, triangleCount * 12);
+  for (int t = 0; t < triangleCount; ++t) {
+    // bit i of the feature edges is the edge from corner i to the next, opposite corner i + 2
+    const GLubyte feature = data.featureEdges(t);
+    const GLubyte hidden = ((feature & 0x2) ? 0 : 0x1) | ((feature & 0x4) ? 0 : 0x2) | ((feature & 0x1) ? 0 : 0x4);
+
+    for (int corner = 0; corner < 3; ++corner) {
+      GLubyte *v = &edges[t * 12 + corner * 4];
+      v[corner] = 1;
+      v[3] = hidden;
+    }
+  }
+
+  // assumption: data has no grid or axes yet
+  gridVertexIdx = -1;
+  gridLabelIdx = -1;
+  axesVertexIdx = -1;
+  axesLabelIdx = -1;
+}
+
+
+GLScene::GLScene(QObject *parent)
+  : QObject(parent),
+    m_dirty(true),
+    m_scalarsDirty(false),
+    m_linesDirty(false),
+    m_layoutDirty(false),
+    m_edgesSupported(false),
+    m_views(0),
+    m_group(nullptr),
+    m_applying(false),
+    m_submitted(nullptr),
+    m_appliedTicket(0),
+    m_lastTicket(0),
+    m_waiting(0)
+{
+  m_setup.font = m_content.labels.font();
+  m_content.layout(m_setup);
+}
+
+GLScene::~GLScene() {
+  if (m_views > 0)
+    std::cerr << "WARNING: scene deleted while still in use by " << m_views << " view(s)" << std::endl;
+
+  delete m_submitted.load();
+}
+
+
+void GLScene::setData(const GLData &data) {
+  Content content;
+  content.setData(data);
+  content.layout(m_setup);
+
+  setData(content);
+}
+
+void GLScene::setData(const Content &content) {
+  m_content.data = content.data;
+  m_content.edges = content.edges;
+  m_content.objects.takeData(content.objects);
+  m_content.points.takeData(content.points);
+
+  // where the grid and axes are in the data, if it has them, to replace them
+  m_content.gridVertexIdx = content.gridVertexIdx;
+  m_content.gridLabelIdx = content.gridLabelIdx;
+  m_content.axesVertexIdx = content.axesVertexIdx;
+  m_content.axesLabelIdx = content.axesLabelIdx;
+
+  // laid out for what we show, or else again by syncGL()
+  m_layoutDirty = content.gridVertexIdx < 0 || !(content.setup == m_setup);
+  if (!m_layoutDirty) {
+    m_content.lines.takeData(content.lines);
+    m_content.labels.takeData(content.labels);
+    m_content.setup = content.setup;
+  }
+
+  m_dirty = true;
+  notifyChanged();
+}
+
+void GLScene::setScalars(const QVector<GLfloat> &scalars) {
+  if (!m_content.data.setScalars(scalars))
+    return;
+
+  m_scalarsDirty = true;
+  notifyChanged();
+}
+
+void GLScene::setGridConfig(const GridConfig &grid) {
+  {
+    QMutexLocker locker(&m_setupMutex);
+    m_setup.grid = grid;
+  }
+
+  m_layoutDirty = true;
+  notifyChanged();
+}
+
+void GLScene::setAxesConfig(const AxesConfig &axes) {
+  {
+    QMutexLocker locker(&m_setupMutex);
+    m_setup.axes = axes;
+  }
+
+  m_layoutDirty = true;
+  notifyChanged();
+}
+
+void GLScene::setLabelFont(const QFont &font) {
+  {
+    QMutexLocker locker(&m_setupMutex);
+    m_setup.font = font;
+  }
+
+  m_layoutDirty = true;
+  notifyChanged();
+}
+
+GLScene::Setup GLScene::setup() const {
+  QMutexLocker locker(&m_setupMutex);
+  return m_setup;
+}
+
+void GLScene::setObjectVisible(int object, bool visible) {
+  if (m_content.objects.setVisible(object, visible))
+    notifyChanged();
+}
+
+void GLScene::setObjectTransform(int object, const QMatrix4x4 &model) {
+  if (m_content.objects.setTransform(object, model))
+    notifyChanged();
+}
+
+void GLScene::setObjectTint(int object, const QVector4D &tint) {
+  if (m_content.objects.setTint(object, tint))
+    notifyChanged();
+}
+
+void GLScene::setObjectOpacity(int object, float opacity) {
+  if (object < 0 || object >= objectCount()) {
+    std::cerr << "WARNING: no object " << object << ", there are " << objectCount() << std::endl;
+    return;
+  }
+
+  QVector4D tint = m_content.objects.tint(object);
+  tint.setW(opacity);
+  setObjectTint(object, tint);
+}
+
+void GLScene::notifyChanged() {
+  if (!m_applying)
+    emit changed();
+}
+
+// a batch waiting for the views
+struct GLScene::Submitted {
+  SceneEdit edit;
+  quint64 ticket;     // of the last batch merged into it
+};
+
+quint64 GLScene::submit(const SceneEdit &edit) {
+  // new data is laid out for our grid, axes and font here, on the producer's thread
+  SceneEdit laidOut = edit;
+  laidOut.layout(setup());
+
+  quint64 ticket;
+  bool idle;
+
+  {
+    QMutexLocker locker(&m_submitMutex);
+
+    // take the batch back unless a view already has, and append to it
+    Submitted *submitted = m_submitted.exchange(nullptr);
+    idle = submitted == nullptr;
+    if (idle)
+      submitted = new Submitted;
+
+    submitted->edit.merge(laidOut);
+    submitted->ticket = ticket = ++m_lastTicket;
+    m_submitted.store(submitted);
+  }
+
+  // a merged batch already has a repaint pending; queued to the views' thread
+  if (idle)
+    emit changed();
+
+  return ticket;
+}
+
+bool GLScene::waitForApplied(quint64 ticket, int timeout) {
+  QMutexLocker locker(&m_submitMutex);
+  QElapsedTimer elapsed;
+  elapsed.start();
+
+  ++m_waiting;
+  while (m_appliedTicket.load() < ticket) {
+    if (timeout < 0) {
+      m_applied.wait(&m_submitMutex);
+      continue;
+    }
+
+    const qint64 remaining = timeout - elapsed.elapsed();
+    if (remaining <= 0 || !m_applied.wait(&m_submitMutex, remaining))
+      break;
+  }
+  --m_waiting;
+
+  return m_appliedTicket.load() >= ticket;
+}
+
+bool GLScene::applySubmitted() {
+  Submitted *submitted = m_submitted.exchange(nullptr);
+  if (submitted == nullptr)
+    return false;
+
+  // the views are about to paint anyway; changed() itself isn't blocked, it may come from a producer
+  m_applying = true;
+  submitted->edit.apply(*this);
+  m_applying = false;
+
+  m_appliedTicket.store(submitted->ticket);
+  delete submitted;
+
+  // the mutex is only taken if a producer waits for this
+  if (m_waiting.load() > 0) {
+    QMutexLocker locker(&m_submitMutex);
+    m_applied.wakeAll();
+  }
+
+  return true;
+}
+
+
+void GLScene::Content::layout(const Setup &newSetup) {
+  const GridConfig &grid = newSetup.grid;
+  const AxesConfig &axes = newSetup.axes;
+
+  if (gridVertexIdx > -1) {
+    // if there were already a grid and axes, delete them before rebuilding
+    data.resizeLineVertexCount(gridVertexIdx);
+    data.resizeLabelCount(gridLabelIdx);
+  }
+
+  gridVertexIdx = data.lineVertexCount();
+  gridLabelIdx = data.labelCount();
+
+  // setup grid, every line once: overlapping lines would be blended several times
+  const float &gridWidth = grid.lineWidth;
+
+  // parallel to x
+  for (int y = grid.minY; y <= grid.maxY; y += grid.step)
+    data.addLine(QVector3D(grid.minX, y, 0), QVector3D(grid.maxX, y, 0), grid.color, gridWidth);
+
+  // parallel to y
+  for (int x = grid.minX; x <= grid.maxX; x += grid.step)
+    data.addLine(QVector3D(x, grid.minY, 0), QVector3D(x, grid.maxY, 0), grid.color, gridWidth);
+
+  // coordinates along the axes, dropped first when labels overlap
+  for (int x = grid.minX; x <= grid.maxX; x += grid.step)
+    if (x != 0)
+      data.addLabel(QVector3D(x, 0, 0), QString::number(x), grid.color, -1);
+
+  for (int y = grid.minY; y <= grid.maxY; y += grid.step)
+    if (y != 0)
+      data.addLabel(QVector3D(0, y, 0), QString::number(y), grid.color, -1);
+
+  axesVertexIdx = data.lineVertexCount();
+  axesLabelIdx = data.labelCount();
+
+  // setup coordinate axes
+  const float &length = axes.length;
+  const float &arrSize = axes.arrowSize;
+  const float &axesWidth = axes.lineWidth;
+
+  // x (red)
+  data.addLine(QVector3D(-length, 0, 0), QVector3D(length, 0, 0), axes.colorX, axesWidth);
+
+  // arrow
+  data.addLine(QVector3D(length, 0, 0), QVector3D(length - arrSize, arrSize / 2, 0), axes.colorX, axesWidth);
+  data.addLine(QVector3D(length, 0, 0), QVector3D(length - arrSize, -arrSize / 2, 0), axes.colorX, axesWidth);
+
+  // y (green)
+  data.addLine(QVector3D(0, -length, 0), QVector3D(0, length, 0), axes.colorY, axesWidth);
+
+  // arrow
+  data.addLine(QVector3D(0, length, 0), QVector3D(arrSize / 2, length - arrSize, 0), axes.colorY, axesWidth);
+  data.addLine(QVector3D(0, length, 0), QVector3D(-arrSize / 2, length - arrSize, 0), axes.colorY, axesWidth);
+
+  // z (blue)
+  data.addLine(QVector3D(0, 0, -length), QVector3D(0, 0, length), axes.colorZ, axesWidth);
+
+  // arrow
+  data.addLine(QVector3D(0, 0, length), QVector3D(arrSize / 2, 0, length - arrSize), axes.colorZ, axesWidth);
+  data.addLine(QVector3D(0, 0, length), QVector3D(-arrSize / 2, 0, length - arrSize), axes.colorZ, axesWidth);
+
+  // the axes names at the arrows, placed before any other label
+  data.addLabel(QVector3D(length, 0, 0), "x", axes.colorX, 1);
+  data.addLabel(QVector3D(0, length, 0), "y", axes.colorY, 1);
+  data.addLabel(QVector3D(0, 0, length), "z", axes.colorZ, 1);
+
+  lines.setData(data, gridVertexIdx, axesVertexIdx);
+
+  // a new font means a new atlas, with all characters
+  if (!(labelnewSetup.font() == newSetup.font))
+    labels.setFont(newSetup.font);
+  labels.setData(data, gridLabelIdx, axesLabelIdx);
+
+  setup = newSetup;
+}
+
+
+
+bool GLScene::attachGL() {
+  QOpenGLContextGroup *group = QOpenGLContext::currentContext()->shareGroup();
+  if (m_views > 0 && group != m_group) {
+    std::cerr << "ERROR: the views of a scene have to share their contexts, enable Qt::AA_ShareOpenGLContexts" << std::endl;
+    return false;
+  }
+
+  if (m_views++ > 0)
+    return true;
+
+  // first view: create the buffers in the share group
+  m_group = group;
+  initializeOpenGLFunctions();
+  m_content.objects.initializeGL();
+  m_content.lines.initializeGL();
+  m_content.points.initializeGL();
+  m_content.labels.initializeGL();
+
+  GLint maxAttribs = 0;
+  glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &maxAttribs);
+  m_edgesSupported = maxAttribs > EdgeAttrib;
+
+  if (!m_trisVbo.create() || !m_scalarsVbo.create() || !m_edgesVbo.create())
+    std::cerr << "ERROR: failed to create vertex buffer object" << std::endl;
+
+  m_dirty = true;
+  syncGL();
+  return true;
+}
+
+void GLScene::detachGL() {
+  if (--m_views > 0)
+    return;
+
+  // last view: nobody needs the buffers anymore
+  m_group = nullptr;
+  m_trisVbo.destroy();
+  m_scalarsVbo.destroy();
+  m_edgesVbo.destroy();
+  m_content.objects.destroyGL();
+  m_content.lines.destroyGL();
+  m_content.points.destroyGL();
+  m_content.labels.destroyGL();
+}
+
+
+void GLScene::syncGL() {
+  // the grid, axes or font changed since the lines and labels were laid out
+  if (m_layoutDirty) {
+    m_layoutDirty = false;
+    m_content.layout(m_setup);
+    m_linesDirty = true;
+  }
+
+  // the atlas is only uploaded when the font or characters changed
+  m_content.labels.upload();
+
+  if (m_scalarsDirty || m_dirty) {
+    m_scalarsDirty = false;
+
+    // without scalars, the attribute is disabled and the buffer stays empty
+    m_scalarsVbo.bind();
+    m_scalarsVbo.allocate(m_content.data.scalarConstData(), m_content.data.scalarCount() * sizeof(GLfloat));
+    m_scalarsVbo.release();
+  }
+
+  // the grid and axes changed, but not the data
+  if (m_linesDirty && !m_dirty)
+    m_content.lines.upload();
+
+  m_linesDirty = false;
+
+  if (!m_dirty)
+    return;
+
+  m_dirty = false;
+
+  m_content.objects.upload();
+
+  // the VAOs of the views refer to the buffers, not their storage,
+  // so they stay valid when the buffers are reallocated
+  m_trisVbo.bind();
+  m_trisVbo.allocate(m_content.data.triangleConstData(), m_content.data.triangleDataSize() * sizeof(GLfloat));
+  m_trisVbo.release();
+
+  m_edgesVbo.bind();
+  m_edgesVbo.allocate(m_content.edges.constData(), m_content.edges.size());
+  m_edgesVbo.release();
+
+  m_content.lines.upload();
+  m_content.points.upload(m_content.data);
+}
+
+
+void GLScene::setupTriangleVertexAttribs() {
+  m_trisVbo.bind();
+  setupVertexAttribs();
+  m_trisVbo.release();
+
+  // per-object model matrix and tint
+  m_content.objects.setupVertexAttribs();
+}
+
+void GLScene::setupCulledTriangleVertexAttribs() {
+  m_trisVbo.bind();
+  setupVertexAttribs();
+  m_trisVbo.release();
+
+  // per-command model matrix and tint, written by the culling
+  m_content.objects.setupCulledVertexAttribs();
+}
+
+void GLScene::setupLineVertexAttribs() {
+  m_content.lines.setupVertexAttribs();
+}
+
+void GLScene::setupPointVertexAttribs() {
+  m_content.points.setupVertexAttribs();
+}
+
+void GLScene::setupLabelVertexAttribs(QOpenGLBuffer &instances) {
+  m_content.labels.setupVertexAttribs(instances);
+}
+
+void GLScene::setupVertexAttribs() {
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+
+  // 3 floats for first group of attributes (triangle pos), then 3 floats for second group (color)
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), nullptr);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<void *>(3 * sizeof(GLfloat)));
+
+  // scalars from their own buffer, so they can be replaced alone; enabled by the views when colormapping
+  m_scalarsVbo.bind();
+  glVertexAttribPointer(ScalarAttrib, 1, GL_FLOAT, GL_FALSE, sizeof(GLfloat), nullptr);
+
+  // likewise enabled by the views when drawing edges
+  if (m_edgesSupported) {
+    m_edgesVbo.bind();
+    glVertexAttribPointer(EdgeAttrib, 4, GL_UNSIGNED_BYTE, GL_FALSE, 4, nullptr);
+  }
+  m_trisVbo.bind();
+}
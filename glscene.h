@@ -0,0 +1,260 @@
+#ifndef GLSCENE_H
+#define GLSCENE_H
+
+#include <QObject>
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include "gldata.h"
+#include "globjects.h"
+#include "gllabels.h"
+#include "gllines.h"
+#include "glpoints.h"
+
+QT_FORWARD_DECLARE_CLASS(QOpenGLContextGroup)
+QT_FORWARD_DECLARE_CLASS(SceneEdit)
+
+struct GridConfig {
+  GridConfig();
+
+  int minX, maxX;   // draw the grid from minX to maxX
+  int minY, maxY;   // ...and from minY to maxY
+  int step;
+
+  QVector3D color;  // grid color
+  float lineWidth;  // in pixels
+};
+
+struct AxesConfig {
+  AxesConfig();
+
+  float length;
+  float arrowSize;
+
+  QVector3D colorX, colorY, colorZ;
+  float lineWidth;  // in pixels
+};
+
+
+/**
+ * The scene: the data, grid, axes, objects and point clouds, and the GPU
+ * buffers they live in.
+ *
+ * A scene can be shown by several QGLViewer views at once. The buffers are
+ * created once in the share group of the views' contexts (enable
+ * Qt::AA_ShareOpenGLContexts) and uploaded once, by whichever view paints
+ * first after a change. The views only hold their vertex array objects,
+ * cameras and view settings.
+ *
+ * The setters are for the thread of the scene. Other threads submit their
+ * changes as SceneEdit batches instead, see submit().
+ *
+ * The scene has to outlive its views.
+ */
+class GLScene : public QObject, protected QOpenGLFunctions
+{
+  Q_OBJECT
+public:
+  // vertex attribute locations of the scene program, after those of GLObjects
+  enum Attrib {
+    ScalarAttrib = 7,
+    EdgeAttrib   = 8    // beyond the 8 attributes OpenGL ES 2.0 guarantees
+  };
+
+  // the grid, axes and label font, what the scene adds to the data
+  struct Setup {
+    GridConfig grid;
+    AxesConfig axes;
+    QFont font;
+
+    bool operator==(const Setup &other) const;
+  };
+
+  /**
+   * The CPU side of the scene: the data with its points shuffled and the grid
+   * and axes appended, and its edges, objects, lines, points and labels
+   * prepared for drawing. SceneEdit prepares it on the producer's thread, so
+   * the views only take it over and upload it.
+   */
+  struct Content {
+    Content();
+
+    // the data without grid and axes; shuffles the points of our copy
+    void setData(const GLData &data);
+
+    // append the grid and axes of the setup, replacing those there are, and lay out the lines and labels
+    void layout(const Setup &setup);
+
+    GLData data;
+    QVector<GLubyte> edges;             // 4 bytes per triangle vertex, see setupVertexAttribs()
+    GLObjects objects;
+    GLPoints points;
+    GLLines lines;
+    GLLabels labels;
+
+    int gridVertexIdx, gridLabelIdx;    // -1 until laid out
+    int axesVertexIdx, axesLabelIdx;
+    Setup setup;                        // laid out for
+  };
+
+  GLScene(QObject *parent = nullptr);
+  ~GLScene() override;
+
+  // prepares the data here, on the scene's thread; see also SceneEdit::setData()
+  void setData(const GLData &data);
+
+  // take over prepared content; its lines and labels are laid out again if the setup changed since
+  void setData(const Content &content);
+
+  /**
+   * Replace the scalars of the triangle vertices, see GLData::setScalars().
+   * Only the scalars are uploaded, 4 bytes per vertex; the views map them
+   * to colors, see QGLViewer::setColormapConfig().
+   */
+  void setScalars(const QVector<GLfloat> &scalars);
+
+  // the grid and axes are laid out again by the next syncGL()
+  void setGridConfig(const GridConfig &grid);
+  void setAxesConfig(const AxesConfig &axes);
+
+  // with the points of each span shuffled, see GLPoints
+  const GLData &data() const                      { return m_content.data; }
+
+  // lines: the data lines are followed by the grid and then the axes
+  int gridVertexIdx() const                       { return m_content.gridVertexIdx; }
+  int axesVertexIdx() const                       { return m_content.axesVertexIdx; }
+
+  // labels: likewise, the data labels are followed by those of the grid and the axes
+  int gridLabelIdx() const                        { return m_content.gridLabelIdx; }
+  int axesLabelIdx() const                        { return m_content.axesLabelIdx; }
+
+  // the font of all labels
+  void setLabelFont(const QFont &font);
+
+  // thread-safe, for preparing content off the scene's thread
+  Setup setup() const;
+
+  // object layer: the named objects of the data, see GLData::beginObject()
+  int objectCount() const                         { return m_content.objects.count(); }
+  int objectIndex(const QString &name) const      { return m_content.objects.indexOf(name); }   // -1 if none
+
+  // indices outside 0 to objectCount() - 1 are ignored with a warning
+  void setObjectVisible(int object, bool visible);
+  void setObjectTransform(int object, const QMatrix4x4 &model);
+  void setObjectTint(int object, const QVector4D &tint);
+
+  // the tint alpha; objects with an opacity below 1 are drawn translucent
+  void setObjectOpacity(int object, float opacity);
+
+  GLObjects &objects()                            { return m_content.objects; }
+
+  // data lines, grid and axes as screen-space quads
+  GLLines &lines()                                { return m_content.lines; }
+
+  // the point clouds of the data
+  GLPoints &points()                              { return m_content.points; }
+
+  // the labels of the data, grid and axes
+  GLLabels &labels()                              { return m_content.labels; }
+
+
+  /**
+   * Thread-safe: queue a batch of changes. It is applied by the next view to
+   * paint, at the start of its frame, so every frame shows the changes of
+   * whole batches. Until then, further batches are merged into the queued
+   * one: producers faster than the views don't queue up frames, and the
+   * views never wait for them.
+   *
+   * New data is prepared for drawing by SceneEdit::setData(), and its lines
+   * and labels are laid out here for the scene's grid, axes and font, both on
+   * the calling thread. Applying a batch then only takes the prepared arrays
+   * over, implicitly shared, and uploads them. Object changes for indices the
+   * scene doesn't have are ignored.
+   *
+   * @return a ticket for waitForApplied()
+   */
+  quint64 submit(const SceneEdit &edit);
+
+  /**
+   * Thread-safe: block until the batch with the ticket, or a later one it
+   * was merged with, is applied. Producers that want back-pressure call this
+   * before building their next batch.
+   *
+   * @param timeout in ms, -1 to wait forever
+   * @return false on timeout
+   */
+  bool waitForApplied(quint64 ticket, int timeout = -1);
+
+  // the ticket of the last applied batch
+  quint64 appliedTicket() const                   { return m_appliedTicket.load(); }
+
+  // apply the queued batch, if any, without blocking; called by the views
+  bool applySubmitted();
+
+
+  // GPU side, called by the views with their context current
+
+  // a view starts/stops using the buffers; the first creates them, the last destroys them.
+  // Fails if the view's context isn't in the share group of the buffers
+  bool attachGL();
+  void detachGL();
+
+  // upload whatever changed since the last frame
+  void syncGL();
+
+  // the context has enough vertex attributes for the edge overlay, see QGLViewer::setEdgeConfig()
+  bool edgesSupported() const                     { return m_edgesSupported; }
+
+  // setup the vertex attributes in the currently bound VAO
+  void setupTriangleVertexAttribs();
+  void setupCulledTriangleVertexAttribs();    // see GLObjects::drawCulled()
+  void setupLineVertexAttribs();
+  void setupPointVertexAttribs();
+  void setupLabelVertexAttribs(QOpenGLBuffer &instances);   // see GLLabels::place()
+
+signals:
+  // the views need to be repainted
+  void changed();
+
+private:
+  void setupVertexAttribs();
+
+  // emit changed(), unless a batch is being applied
+  void notifyChanged();
+
+  Content m_content;
+  bool m_dirty;         // data needs to be uploaded
+  bool m_scalarsDirty;  // only the scalars need to be uploaded
+  bool m_linesDirty;    // only the lines need to be uploaded, the labels have no buffer but the atlas
+  bool m_layoutDirty;   // the setup changed, the lines and labels need to be laid out again
+
+  // written on the scene's thread only, so it reads it without the lock
+  Setup m_setup;
+  mutable QMutex m_setupMutex;
+
+  QOpenGLBuffer m_trisVbo;
+  QOpenGLBuffer m_scalarsVbo;
+  QOpenGLBuffer m_edgesVbo;
+  bool m_edgesSupported;
+
+  int m_views;      // number of views using the buffers
+  QOpenGLContextGroup *m_group;   // of the views' contexts, while there are views
+  bool m_applying;                // in applySubmitted(), on the scene's thread
+
+  // the submitted batch, swapped out by applySubmitted() without a lock
+  struct Submitted;
+  std::atomic<Submitted *> m_submitted;
+  std::atomic<quint64> m_appliedTicket;
+
+  // producers only, the views lock it just to wake waiting producers
+  QMutex m_submitMutex;
+  quint64 m_lastTicket;
+  QWaitCondition m_applied;
+  std::atomic<int> m_waiting;
+};
+
+#endif  // GLSCENE_H
@@ -1,21 +1,240 @@
 #include "qglviewer.h"
 #include "camera.h"
+#include "sceneedit.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+
+
+// stacks of thin cuboids with gaps as thin as the cuboids at increasing distances,
+// they z-fight in the distance unless reverse-Z is used
+static GLData zFightingScene() {
+  GLData data;
+
+  const float size = 400;
+  const float thickness = 0.25f;
+
+  for (float distance : { 500, 1000, 2000, 3500 }) {
+    const float x0 = -distance - size / 2;
+    const float x1 = -distance + size / 2;
+
+    for (int i = 0; i < 8; ++i) {
+      const float z = i * 2 * thickness;
+      data.addCuboid(QVector3D(x1, -size / 2, z), QVector3D(x1, size / 2, z),
+                     QVector3D(x0, -size / 2, z), QVector3D(x0, size / 2, z),
+                     thickness, i % 2, 0.5f * (i % 3));
+    }
+  }
+
+  return data;
+}
+
+// a terrain of unit cubes stacked into columns, with lots of hidden and coplanar faces
+static GLData blocksScene() {
+  GLData data;
+
+  const int n = 64;
+  const float size = 10;
+
+  data.beginCuboids(true);
+
+  for (int x = 0; x < n; ++x) {
+    for (int y = 0; y < n; ++y) {
+      const int height = 1 + qRound(4 + 3 * std::sin(x * 0.2f) * std::cos(y * 0.15f));
+
+      const float x0 = (x - n / 2) * size;
+      const float y0 = (y - n / 2) * size;
+
+      for (int z = 0; z < height; ++z) {
+        const float top = (z + 1) * size;
+        data.addCuboid(QVector3D(x0 + size, y0, top), QVector3D(x0 + size, y0 + size, top),
+                       QVector3D(x0, y0, top), QVector3D(x0, y0 + size, top),
+                       size, z / 8.0f, 0);
+      }
+    }
+  }
+
+  GLData::CuboidStats stats = data.endCuboids();
+  std::cout << "cuboids: " << stats.triangles << " triangles, " << stats.hiddenTriangles << " hidden, "
+            << stats.mergedTriangles << " merged, " << stats.junctionTriangles << " added at T-junctions, "
+            << data.triangleVertexCount() / 3 << " left" << std::endl;
+
+  // the height of each vertex, for colormapping
+  QVector<GLfloat> heights;
+  for (int v = 0; v < data.triangleVertexCount(); ++v)
+    heights.push_back(data.triangleConstData()[6 * v + 2]);
+
+  data.setScalars(heights);
+
+  return data;
+}
+
+// a terrain scanned into 4 million points, in 8x8 tiles for subsampling
+static GLData pointsScene() {
+  GLData data;
+
+  const int tiles = 8;
+  const float tileSize = 250;
+  const int pointsPerTile = 1 << 16;
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> uniform(0, tileSize);
+
+  for (int tx = 0; tx < tiles; ++tx) {
+    for (int ty = 0; ty < tiles; ++ty) {
+      const DVector3 origin((tx - tiles / 2) * tileSize, (ty - tiles / 2) * tileSize, 0);
+      data.beginChunk(origin);
+
+      for (int i = 0; i < pointsPerTile; ++i) {
+        const float x = uniform(random);
+        const float y = uniform(random);
+        const float h = 40 * std::sin((origin.x + x) * 0.01f) * std::cos((origin.y + y) * 0.013f);
+
+        data.addPoint(QVector3D(x, y, h), QVector3D(0.5f + h / 80, 0.8f, 0.5f - h / 80));
+      }
+
+      data.endChunk();
+    }
+  }
+
+  return data;
+}
+
+// a city of 40000 blocks, each in its own chunk, to test GPU culling
+static GLData cityScene() {
+  GLData data;
+
+  const int n = 200;
+  const float spacing = 40;
+  const float size = 20;
+
+  for (int x = 0; x < n; ++x) {
+    for (int y = 0; y < n; ++y) {
+      const float height = size * (1 + (x * 7 + y * 13) % 5);
+
+      data.beginChunk(DVector3((x - n / 2) * spacing, (y - n / 2) * spacing, 0));
+      data.addCuboid(QVector3D(size, 0, height), QVector3D(size, size, height),
+                     QVector3D(0, 0, height), QVector3D(0, size, height),
+                     height, 0.2f * ((x + y) % 5), 0);
+      data.endChunk();
+    }
+  }
+
+  return data;
+}
+
+// 100000 labeled points in 10x10 tiles, of which only the non-overlapping ones are drawn
+static GLData labelsScene() {
+  GLData data;
+
+  const int tiles = 10;
+  const float tileSize = 400;
+  const int labelsPerTile = 1000;
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> uniform(0, tileSize);
+
+  for (int tx = 0; tx < tiles; ++tx) {
+    for (int ty = 0; ty < tiles; ++ty) {
+      data.beginChunk(DVector3((tx - tiles / 2) * tileSize, (ty - tiles / 2) * tileSize, 0));
+
+      for (int i = 0; i < labelsPerTile; ++i) {
+        const QVector3D position(uniform(random), uniform(random), 0);
+        const int id = (tx * tiles + ty) * labelsPerTile + i;
+
+        // every 100th label is more important
+        const float priority = id % 100 == 0 ? 1 : 0;
+
+        data.addPoint(position, QVector3D(1, 1, 1));
+        data.addLabel(position, QString("P%1").arg(id), QVector3D(1, 1, priority > 0 ? 0 : 1), priority);
+      }
+
+      data.endChunk();
+    }
+  }
+
+  return data;
+}
+
+
+// a simulation thread: waves over the scalars of the scene data, one batch per frame at most
+static void animateScalars(GLScene *scene, const GLData &data, const std::atomic<bool> &running) {
+  QVector<GLfloat> scalars(data.triangleVertexCount());
+
+  for (int step = 0; running; ++step) {
+    for (int v = 0; v < scalars.size(); ++v) {
+      const GLfloat *vertex = data.triangleConstData() + 6 * v;
+      scalars[v] = vertex[2] + 20 * std::sin(0.01f * (vertex[0] + vertex[1]) + 0.1f * step);
+    }
+
+    SceneEdit edit;
+    edit.setScalars(scalars);
+
+    // back-pressure: wait for the views, but check regularly if we should stop
+    const quint64 ticket = scene->submit(edit);
+    while (running && !scene->waitForApplied(ticket, 100)) {}
+  }
+}
 
 int main(int argc, char *argv[])
 {
+  // all viewers share one context group, and thus their shader programs
+  QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+
   QApplication app(argc, argv);
 
   QCoreApplication::setApplicationName("Qt GL Viewer Example");
   QCoreApplication::setApplicationVersion("1.0.0");
 
-  QGLViewer viewer;
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  parser.addVersionOption();
 
-  // GL camera config
-  Camera *camera = viewer.camera();
+  QCommandLineOption reverseZOption("reverse-z", "Use reverse-Z with an infinite far plane.");
+  QCommandLineOption sceneOption("scene", "Test scene to show: zfighting, blocks, points, city or labels.", "name");
+  QCommandLineOption animateOption("animate", "Animate the scalars of the blocks scene from another thread.");
+  QCommandLineOption viewsOption("views", "Show the scene in two windows.");
+  QCommandLineOption splitOption("split", "Show the scene in two viewports side by side.");
+  parser.addOptions({ reverseZOption, sceneOption, animateOption, viewsOption, splitOption });
+  parser.process(app);
+
+  // one scene for all viewers, so it's uploaded once; it has to outlive them
+  GLScene scene;
+
+  std::atomic<bool> running(true);
+  std::thread producer;
+
+  ColormapConfig colormap;
+  PointConfig points;
+
+  if (parser.value(sceneOption) == "zfighting")
+    scene.setData(zFightingScene());
+  else if (parser.value(sceneOption) == "blocks") {
+    colormap.maxValue = 80;
+
+    const GLData data = blocksScene();
+    scene.setData(data);
+
+    if (parser.isSet(animateOption))
+      producer = std::thread(animateScalars, &scene, data, std::cref(running));
+  }
+  else if (parser.value(sceneOption) == "points") {
+    points.fullDensityDistance = 800;
+    scene.setData(pointsScene());
+  }
+  else if (parser.value(sceneOption) == "city")
+    scene.setData(cityScene());
+  else if (parser.value(sceneOption) == "labels")
+    scene.setData(labelsScene());
 
+  // GL camera config
   CameraConfig config;
   config.c_mode = CameraMode::Target;
   config.p_mode = ProjectionMode::Perspective;
@@ -31,9 +250,46 @@ int main(int argc, char *argv[])
   config.WorldRight   = QVector3D(0, 1, 0);
   config.WorldUp      = QVector3D(0, 0, 1);
 
-  camera->setConfig(config);
+  // the view settings are per viewer, the scene is shared
+  auto setupViewer = [&](QGLViewer &viewer) {
+    viewer.setScene(&scene);
+    viewer.setReverseZ(parser.isSet(reverseZOption));
+    viewer.setColormapConfig(colormap);
+    viewer.setPointConfig(points);
+
+    if (parser.isSet(splitOption)) {
+      viewer.setViewportRect(0, QRectF(0, 0, 0.5, 1));
+      viewer.addViewport(QRectF(0.5, 0, 0.5, 1));
+    }
 
+    // the second viewport looks from the other side
+    for (int vp = 0; vp < viewer.viewportCount(); ++vp) {
+      CameraConfig viewportConfig = config;
+      if (vp > 0)
+        viewportConfig.initialTranslation = QVector3D(-900, -200, 300);
+      viewer.viewportCamera(vp)->setConfig(viewportConfig);
+    }
+  };
+
+  QGLViewer viewer;
+  setupViewer(viewer);
   viewer.show();
 
-  return app.exec();
+  // a second window on the same scene
+  std::unique_ptr<QGLViewer> second;
+  if (parser.isSet(viewsOption)) {
+    second.reset(new QGLViewer);
+    setupViewer(*second);
+    second->setWindowTitle("Second view");
+    second->show();
+  }
+
+  const int result = app.exec();
+
+  // before the scene goes away
+  running = false;
+  if (producer.joinable())
+    producer.join();
+
+  return result;
 }
\ No newline at end of file
@@ -1,60 +1,155 @@
 #include "qglviewer.h"
 #include "camera.h"
+#include "shadermanager.h"
 
 #include <QMouseEvent>
+#include <QOpenGLContext>
 #include <QOpenGLShaderProgram>
+#include <QVector2D>
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
 
-// grid config defaults
-GridConfig::GridConfig()
-  : minX(-2000), maxX(2000),
-    minY(-2000), maxY(2000),
-    step(100),
-    color(QVector3D(0.7f, 0.7f, 0.7f))
+#ifndef GL_LOWER_LEFT
+#define GL_LOWER_LEFT                     0x8CA1
+#endif
+#ifndef GL_NEGATIVE_ONE_TO_ONE
+#define GL_NEGATIVE_ONE_TO_ONE            0x935E
+#endif
+#ifndef GL_ZERO_TO_ONE
+#define GL_ZERO_TO_ONE                    0x935F
+#endif
+#ifndef GL_PROGRAM_POINT_SIZE
+#define GL_PROGRAM_POINT_SIZE             0x8642
+#endif
+#ifndef GL_POINT_SPRITE
+#define GL_POINT_SPRITE                   0x8861
+#endif
+
+
+// render quality levels: the fraction of the resolution and the maximum MSAA samples
+static const struct {
+  float scale;
+  int samples;      // -1: as many as configured
+} qualityLevels[] = {
+  { 1,     -1 },    // full quality
+  { 1,     4 },
+  { 1,     2 },
+  { 0.75f, 2 },
+  { 0.5f,  0 },
+  { 0.35f, 0 }
+};
+
+static const int qualityLevelCount = sizeof(qualityLevels) / sizeof(qualityLevels[0]);
+
+
+// quality config defaults
+QualityConfig::QualityConfig()
+  : samples(8),
+    adaptive(true),
+    targetFrameTime(16),
+    idleDelay(250)
 {}
 
-// axes config defaults
-AxesConfig::AxesConfig()
-  : length(250.0f),
-    arrowSize(10.0f),
-    colorX(QVector3D(1, 0, 0)),
-    colorY(QVector3D(0, 1, 0)),
-    colorZ(QVector3D(0, 0, 1))
+// point config defaults
+PointConfig::PointConfig()
+  : size(3),
+    fullDensityDistance(0),
+    minDensity(0.01f)
+{}
+
+// colormap config defaults: viridis
+ColormapConfig::ColormapConfig()
+  : enabled(true),
+    colors({ QVector3D(0.267f, 0.005f, 0.329f), QVector3D(0.230f, 0.322f, 0.546f), QVector3D(0.128f, 0.567f, 0.551f),
+             QVector3D(0.369f, 0.789f, 0.383f), QVector3D(0.993f, 0.906f, 0.144f) }),
+    minValue(0),
+    maxValue(1),
+    clamp(true)
+{}
+
+// clip config defaults: nothing cut away
+ClipConfig::ClipConfig()
+  : box(false)
+{}
+
+// edge config defaults
+EdgeConfig::EdgeConfig()
+  : enabled(false),
+    color(QVector3D(0.1f, 0.1f, 0.1f)),
+    width(1),
+    featureEdgesOnly(true)
 {}
 
 
 QGLViewer::QGLViewer(QWidget *parent)
   : QOpenGLWidget(parent),
+    m_scene(nullptr),
+    m_sceneAttached(false),
+    m_gpuCulling(true),
+    m_labelsVbo(QOpenGLBuffer::VertexBuffer),
     m_drawGrid(true),
-    m_gridVertexIdx(-1),
-    m_gridConfig(),
     m_drawAxes(true),
-    m_axesVertexIdx(-1),
-    m_axesConfig(),
+    m_lineAntialiasing(true),
     m_program(nullptr),
+    m_linesProgram(nullptr),
+    m_pointsProgram(nullptr),
+    m_labelsProgram(nullptr),
+    m_scenePrograms{},
+    m_colormapTexture(0),
+    m_colormapDirty(true),
+    m_renderTargets(qualityLevelCount),
+    m_interacting(false),
+    m_interactiveLevel(1),
+    m_reverseZ(false),
+    m_glClipControl(nullptr),
+    m_timing(false),
+    m_timedLevel(-1),
+    m_frameTimes({ 0, 0, 0 }),
     m_camera(new Camera)
 {
+  // multisampling is done in the render target
   QSurfaceFormat format;
   format.setDepthBufferSize(24);
-  format.setSamples(8);
   setFormat(format);
+
+  m_viewports.push_back({ QRectF(0, 0, 1, 1), m_camera });
+
+  m_idleTimer.setSingleShot(true);
+  connect(&m_idleTimer, &QTimer::timeout, this, [this]() {
+    // input is idle, render once more at full quality
+    m_interacting = false;
+    update();
+  });
+
+  setScene(new GLScene(this));
 }
 
 QGLViewer::~QGLViewer() {
-  if (m_program == nullptr)
-    return;
+  if (m_program != nullptr) {
+    makeCurrent();
+    m_trisVao.destroy();
+    m_culledTrisVao.destroy();
+    m_linesVao.destroy();
+    m_pointsVao.destroy();
+    m_labelsVao.destroy();
+    m_labelsVbo.destroy();
+    m_transparency.destroyGL();
+    for (RenderTarget &renderTarget : m_renderTargets)
+      renderTarget.destroyGL();
+    glDeleteTextures(1, &m_colormapTexture);
+    m_timeMonitor.destroy();
+    if (m_sceneAttached)
+      m_scene->detachGL();
+    m_program = nullptr;
+    doneCurrent();
+  }
 
-  makeCurrent();
-  m_trisVbo.destroy();
-  m_linesVbo.destroy();
-  delete m_program;
-  m_program = nullptr;
-  doneCurrent();
+  for (Viewport &vp : m_viewports)
+    delete vp.camera;
 
-  delete m_camera;
   m_camera = nullptr;
 }
 
@@ -68,222 +163,742 @@ QSize QGLViewer::sizeHint() const {
 }
 
 
-void QGLViewer::setData(const GLData &data) {
-  m_data = data;
+int QGLViewer::addViewport(const QRectF &rect) {
+  Camera *camera = new Camera;
+  camera->setConfig(m_camera->config());
+  camera->setReverseZ(reverseZActive());
+
+  m_viewports.push_back({ rect, camera });
+  resizeGL(width(), height());
+  update();
 
-  // assumption: data has no grid or axes yet
-  m_gridVertexIdx = -1;
-  m_axesVertexIdx = -1;
+  return m_viewports.size() - 1;
+}
 
-  setupGL();
+void QGLViewer::setViewportRect(int viewport, const QRectF &rect) {
+  m_viewports[viewport].rect = rect;
+  resizeGL(width(), height());
   update();
 }
 
-void QGLViewer::setGridConfig(const GridConfig &grid) {
-  m_gridConfig = grid;
-  setupGL();
+int QGLViewer::viewportAt(const QPoint &pos) const {
+  QPointF p(qreal(pos.x()) / width(), qreal(pos.y()) / height());
+
+  // later viewports are drawn on top
+  for (int i = m_viewports.size() - 1; i >= 0; --i) {
+    if (m_viewports[i].rect.contains(p))
+      return i;
+  }
+
+  return -1;
+}
+
+QRect QGLViewer::viewportPixels(const Viewport &vp, const QSize &size) const {
+  // origin bottom left
+  const qreal w = size.width();
+  const qreal h = size.height();
+
+  return QRect(qRound(vp.rect.x() * w), qRound((1 - vp.rect.bottom()) * h),
+               qRound(vp.rect.width() * w), qRound(vp.rect.height() * h));
+}
+
+
+void QGLViewer::setReverseZ(bool reverse) {
+  m_reverseZ = reverse;
+
+  for (Viewport &vp : m_viewports)
+    vp.camera->setReverseZ(reverseZActive());
+
   update();
 }
 
-void QGLViewer::setAxesConfig(const AxesConfig &axes) {
-  m_axesConfig = axes;
-  setupGL();
+void QGLViewer::setGpuCulling(bool culling) {
+  m_gpuCulling = culling;
   update();
 }
 
+void QGLViewer::setLineAntialiasing(bool antialiasing) {
+  m_lineAntialiasing = antialiasing;
+  update();
+}
 
+bool QGLViewer::reverseZActive() const {
+  // the float depth buffer is in the render target, the [0, 1] depth range needs glClipControl
+  return m_reverseZ && m_renderTargets[0].isSupported() && m_glClipControl != nullptr;
+}
 
-static const char *vertexShaderSource = R"(
-  attribute vec3 vertex;
-  attribute vec3 color;
+void QGLViewer::setScene(GLScene *scene) {
+  if (scene == m_scene)
+    return;
 
-  uniform mat4 mvpMatrix;
+  if (m_program != nullptr) {
+    makeCurrent();
+    if (m_sceneAttached)
+      m_scene->detachGL();
+    m_sceneAttached = false;
+  }
 
-  varying highp vec3 triangle;
+  if (m_scene != nullptr) {
+    disconnect(m_scene, nullptr, this, nullptr);
 
-  void main(void) {
-    triangle = color;
-    gl_Position = mvpMatrix * vec4(vertex, 1.0);
+    // our own scene
+    if (m_scene->parent() == this)
+      delete m_scene;
   }
-)";
 
-static const char *fragmentShaderSource = R"(
-  varying highp vec3 triangle;
+  m_scene = scene;
+  connect(m_scene, &GLScene::changed, this, [this]() { update(); });
 
-  void main() {
-    gl_FragColor = vec4(triangle, 0.5);
+  if (m_program != nullptr) {
+    m_sceneAttached = m_scene->attachGL();
+    if (m_sceneAttached)
+      setupVertexArrays();
+    doneCurrent();
   }
-)";
 
+  update();
+}
+
+void QGLViewer::setData(const GLData &data) {
+  m_scene->setData(data);
+}
 
-void QGLViewer::initializeGL() {
-  initializeOpenGLFunctions();
+void QGLViewer::setGridConfig(const GridConfig &grid) {
+  m_scene->setGridConfig(grid);
+}
 
-  glClearColor(0, 0, 0, 1);
-  glDepthFunc(GL_LESS);
+void QGLViewer::setAxesConfig(const AxesConfig &axes) {
+  m_scene->setAxesConfig(axes);
+}
+
+int QGLViewer::objectCount() const {
+  return m_scene->objectCount();
+}
 
-  m_program = new QOpenGLShaderProgram;
-  m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource);
-  m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource);
-  m_program->bindAttributeLocation("vertex", 0);
-  m_program->bindAttributeLocation("color", 1);
+int QGLViewer::objectIndex(const QString &name) const {
+  return m_scene->objectIndex(name);
+}
 
-  if (!m_program->link())
-    std::cerr << "ERROR: failed to link: " << m_program->log().toStdString();
+void QGLViewer::setObjectVisible(int object, bool visible) {
+  m_scene->setObjectVisible(object, visible);
+}
 
-  m_mvpMatrixLoc = m_program->uniformLocation("mvpMatrix");
+void QGLViewer::setObjectTransform(int object, const QMatrix4x4 &model) {
+  m_scene->setObjectTransform(object, model);
+}
 
-  // Create a vertex array object. In OpenGL ES 2.0 and OpenGL 2.x
-  // implementations this is optional and support may not be present
-  // at all. Nonetheless the below code works in all cases and makes
-  // sure there is a VAO when one is needed.
-  if (!m_trisVao.create() || !m_linesVao.create())
-    std::cerr << "ERROR: faild to create vertex array object" << std::endl;
+void QGLViewer::setObjectTint(int object, const QVector4D &tint) {
+  m_scene->setObjectTint(object, tint);
+}
+
+void QGLViewer::setObjectOpacity(int object, float opacity) {
+  m_scene->setObjectOpacity(object, opacity);
+}
 
-  if (!m_trisVbo.create() || !m_linesVbo.create())
-    std::cerr << "ERROR: failed to create vertex buffer object" << std::endl;
+void QGLViewer::setPointConfig(const PointConfig &points) {
+  m_pointConfig = points;
+  update();
+}
+
+void QGLViewer::setQualityConfig(const QualityConfig &quality) {
+  m_qualityConfig = quality;
+  update();
+}
 
-  setupGL();
+void QGLViewer::setColormapConfig(const ColormapConfig &colormap) {
+  // the range is a uniform, only new colors need an upload
+  if (colormap.colors != m_colormapConfig.colors)
+    m_colormapDirty = true;
 
-  m_camera->reset();
+  m_colormapConfig = colormap;
+  update();
 }
 
+void QGLViewer::setClipConfig(const ClipConfig &clip) {
+  m_clipConfig = clip;
 
-void QGLViewer::initializeGridAndAxes() {
-  if (m_gridVertexIdx > -1) {
-    // if there were already a grid and axes, delete them before rebuilding
-    m_data.resizeLineVertexCount(m_gridVertexIdx);
-  }
+  if (m_clipConfig.planes.size() + (m_clipConfig.box ? 6 : 0) > GLObjects::maxClipPlanes)
+    std::cerr << "WARNING: more than " << GLObjects::maxClipPlanes << " clip planes, ignoring the rest" << std::endl;
 
-  m_gridVertexIdx = m_data.lineVertexCount();
+  update();
+}
 
-  // setup grid
-  for (int x = m_gridConfig.minX; x <= m_gridConfig.maxX; x += m_gridConfig.step) {
-    for (int y = m_gridConfig.minY; y <= m_gridConfig.maxY; y += m_gridConfig.step) {
-      // parallel to x
-      m_data.addLine(QVector3D(-x, y, 0), QVector3D(x, y, 0), m_gridConfig.color);
+void QGLViewer::setEdgeConfig(const EdgeConfig &edges) {
+  m_edgeConfig = edges;
+  update();
+}
 
-      // parallel to y
-      m_data.addLine(QVector3D(x, -y, 0), QVector3D(x, y, 0), m_gridConfig.color);
-    }
+QVector<QVector4D> QGLViewer::clipPlanes(const DVector3 &origin) const {
+  QVector<QVector4D> planes;
+
+  // dot(normal, p + origin - point) >= 0, with the offset in double precision
+  auto addPlane = [&planes, &origin](const DVector3 &point, const QVector3D &normal) {
+    const DVector3 d = origin - point;
+    planes.push_back(QVector4D(normal, float(normal.x() * d.x + normal.y() * d.y + normal.z() * d.z)));
+  };
+
+  for (const ClipPlane &plane : m_clipConfig.planes)
+    addPlane(plane.point, plane.normal);
+
+  if (m_clipConfig.box) {
+    addPlane(m_clipConfig.boxMin, QVector3D(1, 0, 0));
+    addPlane(m_clipConfig.boxMin, QVector3D(0, 1, 0));
+    addPlane(m_clipConfig.boxMin, QVector3D(0, 0, 1));
+    addPlane(m_clipConfig.boxMax, QVector3D(-1, 0, 0));
+    addPlane(m_clipConfig.boxMax, QVector3D(0, -1, 0));
+    addPlane(m_clipConfig.boxMax, QVector3D(0, 0, -1));
   }
 
-  m_axesVertexIdx = m_data.lineVertexCount();
+  if (planes.size() > GLObjects::maxClipPlanes)
+    planes.resize(GLObjects::maxClipPlanes);
 
-  // setup coordinate axes
-  const float &length = m_axesConfig.length;
-  const float &arrSize = m_axesConfig.arrowSize;
+  return planes;
+}
 
-  // x (red)
-  m_data.addLine(QVector3D(-length, 0, 0), QVector3D(length, 0, 0), m_axesConfig.colorX);
+bool QGLViewer::edgesActive() const {
+  return m_edgeConfig.enabled && m_scene->edgesSupported();
+}
 
-  // arrow
-  m_data.addLine(QVector3D(length, 0, 0), QVector3D(length - arrSize, arrSize / 2, 0), m_axesConfig.colorX);
-  m_data.addLine(QVector3D(length, 0, 0), QVector3D(length - arrSize, -arrSize / 2, 0), m_axesConfig.colorX);
+bool QGLViewer::colormapActive() const {
+  return m_colormapConfig.enabled && m_colormapTexture != 0 && m_scene->data().hasScalars();
+}
 
-  // y (green)
-  m_data.addLine(QVector3D(0, -length, 0), QVector3D(0, length, 0), m_axesConfig.colorY);
 
-  // arrow
-  m_data.addLine(QVector3D(0, length, 0), QVector3D(arrSize / 2, length - arrSize, 0), m_axesConfig.colorY);
-  m_data.addLine(QVector3D(0, length, 0), QVector3D(-arrSize / 2, length - arrSize, 0), m_axesConfig.colorY);
+void QGLViewer::interact() {
+  if (!m_qualityConfig.adaptive)
+    return;
 
-  // z (blue)
-  m_data.addLine(QVector3D(0, 0, -length), QVector3D(0, 0, length), m_axesConfig.colorZ);
+  m_interacting = true;
+  m_idleTimer.start(m_qualityConfig.idleDelay);
+}
 
-  // arrow
-  m_data.addLine(QVector3D(0, 0, length), QVector3D(arrSize / 2, 0, length - arrSize), m_axesConfig.colorZ);
-  m_data.addLine(QVector3D(0, 0, length), QVector3D(-arrSize / 2, 0, length - arrSize), m_axesConfig.colorZ);
+void QGLViewer::adaptQuality(float frameTime) {
+  // relative to the level the frame was rendered with, the results lag a few frames behind
+  if (frameTime > m_qualityConfig.targetFrameTime)
+    m_interactiveLevel = std::min(m_timedLevel + 1, qualityLevelCount - 1);
+  else if (frameTime < 0.5f * m_qualityConfig.targetFrameTime)
+    m_interactiveLevel = std::max(m_timedLevel - 1, 0);
 }
 
 
 
-void QGLViewer::setupGL() {
+void QGLViewer::initializeGL() {
+  initializeOpenGLFunctions();
+
+  glClearColor(0, 0, 0, 1);
+  glDepthFunc(GL_LESS);
+
+  // programs are shared by all viewers of a share group
+  m_program = ShaderManager::instance()->program(ShaderManager::Scene);
   if (m_program == nullptr)
     return;
 
-  initializeGridAndAxes();
+  // without it, the scene is drawn without lines
+  m_linesProgram = ShaderManager::instance()->program(ShaderManager::Lines);
+  if (m_linesProgram != nullptr) {
+    m_linesMvpMatrixLoc = m_linesProgram->uniformLocation("mvpMatrix");
+    m_linesViewportSizeLoc = m_linesProgram->uniformLocation("viewportSize");
+  }
+
+  // and without this one, without point clouds
+  m_pointsProgram = ShaderManager::instance()->program(ShaderManager::Points);
+  if (m_pointsProgram != nullptr) {
+    m_pointsMvpMatrixLoc = m_pointsProgram->uniformLocation("mvpMatrix");
+    m_pointSizeLoc = m_pointsProgram->uniformLocation("pointSize");
+  }
 
-  m_trisVao.bind();
-  m_program->bind();
+  // or without labels
+  m_labelsProgram = ShaderManager::instance()->program(ShaderManager::Labels);
+  if (m_labelsProgram != nullptr)
+    m_labelsViewportSizeLoc = m_labelsProgram->uniformLocation("viewportSize");
+
+  // rewritten for every viewport
+  m_labelsVbo.setUsagePattern(QOpenGLBuffer::StreamDraw);
+  if (!m_labelsVbo.create())
+    std::cerr << "ERROR: failed to create label buffer" << std::endl;
+
+  m_transparency.initializeGL();
+
+  // the variants are linked when first drawn with
+  for (SceneProgram &program : m_scenePrograms)
+    program = {};
+
+  // a texture of height 1, sampled linearly between the texel centers
+  glGenTextures(1, &m_colormapTexture);
+  glBindTexture(GL_TEXTURE_2D, m_colormapTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  m_colormapDirty = true;
+
+  const int maxSamples = RenderTarget::maxSamples();
+  for (RenderTarget &renderTarget : m_renderTargets)
+    renderTarget.initializeGL(maxSamples);
+
+  // reverse-Z: depth range [0, 1] instead of [-1, 1], which would waste the float precision
+  m_glClipControl = nullptr;
+  QOpenGLContext *ctx = context();
+  if (!ctx->isOpenGLES() && (ctx->format().version() >= qMakePair(4, 5) || ctx->hasExtension("GL_ARB_clip_control")))
+    m_glClipControl = reinterpret_cast<ClipControl>(ctx->getProcAddress("glClipControl"));
+
+  // optional: needs timer queries
+  m_timeMonitor.setSampleCount(4);
+  if (!m_timeMonitor.create())
+    std::cerr << "WARNING: no timer queries, frame times are not measured" << std::endl;
+
+  // Create a vertex array object. In OpenGL ES 2.0 and OpenGL 2.x
+  // implementations this is optional and support may not be present
+  // at all. Nonetheless the below code works in all cases and makes
+  // sure there is a VAO when one is needed.
+  if (!m_trisVao.create() || !m_culledTrisVao.create() || !m_linesVao.create() || !m_pointsVao.create() || !m_labelsVao.create())
+    std::cerr << "ERROR: faild to create vertex array object" << std::endl;
 
-  // Setup our vertex buffer objects.
+  // the first view of the scene creates its buffers
+  m_sceneAttached = m_scene->attachGL();
+  if (m_sceneAttached)
+    setupVertexArrays();
 
-  // scene objects are in data VBO
-  m_trisVbo.bind();
-  m_trisVbo.allocate(m_data.triangleConstData(), m_data.triangleDataSize() * sizeof(GLfloat));
+  for (Viewport &vp : m_viewports) {
+    vp.camera->reset();
+    vp.camera->setReverseZ(reverseZActive());
+  }
+
+  if (m_reverseZ && !reverseZActive())
+    std::cerr << "WARNING: reverse-Z needs glClipControl and a float depth buffer, using the standard depth range" << std::endl;
+}
 
-  // Store the vertex attribute bindings for the program.
-  setupVertexAttribs();
-  m_trisVbo.release();
 
+void QGLViewer::setupVertexArrays() {
+  // VAOs are not shared between contexts, so every view has its own
+  m_trisVao.bind();
+  m_scene->setupTriangleVertexAttribs();
   m_trisVao.release();
 
+  m_culledTrisVao.bind();
+  m_scene->setupCulledTriangleVertexAttribs();
+  m_culledTrisVao.release();
 
   m_linesVao.bind();
-  m_linesVbo.bind();
-  m_linesVbo.allocate(m_data.lineConstData(), m_data.lineDataSize() * sizeof(GLfloat));
-  setupVertexAttribs();
-  m_linesVbo.release();
+  m_scene->setupLineVertexAttribs();
   m_linesVao.release();
 
-  m_program->release();
+  m_pointsVao.bind();
+  m_scene->setupPointVertexAttribs();
+  m_pointsVao.release();
+
+  m_labelsVao.bind();
+  m_scene->setupLabelVertexAttribs(m_labelsVbo);
+  m_labelsVao.release();
 }
 
-void QGLViewer::setupVertexAttribs() {
-  glEnableVertexAttribArray(0);
-  glEnableVertexAttribArray(1);
+void QGLViewer::uploadColormap() {
+  m_colormapDirty = false;
+
+  auto toByte = [](float c) { return GLubyte(qRound(qBound(0.0f, c, 1.0f) * 255)); };
 
-  // 3 floats for first group of attributes (triangle pos), then 3 floats for second group (color)
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), nullptr);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<void *>(3 * sizeof(GLfloat)));
+  QVector<GLubyte> texels;
+  for (const QVector3D &color : m_colormapConfig.colors)
+    texels << toByte(color.x()) << toByte(color.y()) << toByte(color.z()) << 255;
+
+  // without colors, the tinted white of the objects
+  if (texels.isEmpty())
+    texels << 255 << 255 << 255 << 255;
+
+  glBindTexture(GL_TEXTURE_2D, m_colormapTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texels.size() / 4, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.constData());
+  glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void QGLViewer::paintGL() {
+  if (m_program == nullptr || !m_sceneAttached) {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    return;
+  }
+
+  const qreal dpr = devicePixelRatioF();
+  const QSize widgetSize(qRound(width() * dpr), qRound(height() * dpr));
+  const bool reverseZ = reverseZActive();
+
+  // render into the multisampled render target if possible, then resolve into the widget;
+  // while the camera moves, at a reduced quality level
+  GLuint target = defaultFramebufferObject();
+  GLenum depthFormat = GL_DEPTH24_STENCIL8;
+  QSize size = widgetSize;
+  int level = -1;
+  RenderTarget *renderTarget = nullptr;
+
+  if (m_renderTargets[0].isSupported()) {
+    level = m_interacting ? m_interactiveLevel : 0;
+    renderTarget = &m_renderTargets[level];
+    size = (QSizeF(widgetSize) * qualityLevels[level].scale).toSize().expandedTo(QSize(1, 1));
+
+    int samples = m_qualityConfig.samples;
+    if (qualityLevels[level].samples > -1)
+      samples = std::min(samples, qualityLevels[level].samples);
+
+    renderTarget->resize(size, samples, reverseZ);
+    renderTarget->bind();
+    glViewport(0, 0, size.width(), size.height());
+
+    target = renderTarget->handle();
+    depthFormat = renderTarget->depthFormat();
+  }
+
+  if (reverseZ) {
+    m_glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+    glClearDepthf(0);
+    glDepthFunc(GL_GREATER);
+  } else {
+    glClearDepthf(1);
+    glDepthFunc(GL_LESS);
+  }
+
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_MULTISAMPLE);
   glEnable(GL_CULL_FACE);
 
-  m_program->bind();
-  m_program->setUniformValue(m_mvpMatrixLoc, m_camera->toMatrix());
+  // take the changes submitted by other threads, then upload them along with ours,
+  // unless another view already did
+  m_scene->applySubmitted();
+  m_scene->syncGL();
+
+  // line widths and point sizes are in widget pixels
+  const float scale = float(size.width()) / widgetSize.width();
+
+  // the scene program variants of this frame; colormapping, clipping and edges are just uniforms,
+  // the vertices stay the same
+  const int colormap = colormapActive() ? ShaderManager::Colormap : 0;
+  const int clipping = !m_clipConfig.planes.isEmpty() || m_clipConfig.box ? ShaderManager::Clipping : 0;
+  const int edges = edgesActive() ? ShaderManager::Edges : 0;
+  const int opaqueFeatures = colormap | clipping | edges;
+  const int transparentFeatures = ShaderManager::Transparent | (reverseZ ? ShaderManager::ReverseZ : 0) | opaqueFeatures;
+  const SceneProgram &opaqueProgram = sceneProgram(opaqueFeatures);
+  const SceneProgram &transparentProgram = sceneProgram(transparentFeatures);
+
+  if (colormap) {
+    if (m_colormapDirty)
+      uploadColormap();
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_colormapTexture);
+
+    for (QOpenGLShaderProgram *program : { opaqueProgram.program, transparentProgram.program }) {
+      program->bind();
+      program->setUniformValue("colormap", 0);
+      program->setUniformValue("colormapSize", GLfloat(std::max(m_colormapConfig.colors.size(), 1)));
+      program->setUniformValue("scalarRange", QVector2D(m_colormapConfig.minValue, m_colormapConfig.maxValue));
+      program->setUniformValue("clampScalars", GLint(m_colormapConfig.clamp));
+      program->release();
+    }
+  }
+
+  if (edges) {
+    for (QOpenGLShaderProgram *program : { opaqueProgram.program, transparentProgram.program }) {
+      program->bind();
+      program->setUniformValue("edgeColor", m_edgeConfig.color);
+      program->setUniformValue("edgeWidth", scale * m_edgeConfig.width);
+      program->setUniformValue("featureEdges", GLint(m_edgeConfig.featureEdgesOnly));
+      program->release();
+    }
+  }
+
+  // timer queries are read a few frames later, when the results are there
+  if (m_timing && m_timeMonitor.isResultAvailable()) {
+    const QVector<GLuint64> intervals = m_timeMonitor.waitForIntervals();
+    m_frameTimes.opaque = intervals[0] / 1e6f;
+    m_frameTimes.transparent = intervals[1] / 1e6f;
+    m_frameTimes.overlay = intervals[2] / 1e6f;
+    m_timeMonitor.reset();
+    m_timing = false;
+
+    if (m_interacting && m_timedLevel > -1)
+      adaptQuality(m_frameTimes.opaque + m_frameTimes.transparent + m_frameTimes.overlay);
+  }
 
+  const bool measure = m_timeMonitor.isCreated() && !m_timing;
+  if (measure) {
+    m_timeMonitor.recordSample();
+    m_timedLevel = m_interacting ? level : -1;
+  }
 
   /* It doesn't matter if the vertex attributes are all from one buffer or multiple buffers,
    * and we don't need to bind any particular vertex buffer when drawing; all the glDraw* functions
    * care about is which vertex attribute arrays are enabled.
    */
 
-  m_trisVao.bind();
-  // render as wireframe
-  //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-  glDrawArrays(GL_TRIANGLES, 0, m_data.triangleVertexCount());
-  m_trisVao.release();
+  for (const Viewport &vp : m_viewports) {
+    const QRect r = viewportPixels(vp, size);
+    glViewport(r.x(), r.y(), r.width(), r.height());
+    drawTriangles(opaqueProgram, vp.camera, GLObjects::Opaque);
+  }
 
-  glLineWidth(2);
-  m_linesVao.bind();
-  glDrawArrays(GL_LINES, 0, m_gridVertexIdx);
-  m_linesVao.release();
+  if (m_pointsProgram != nullptr && !m_scene->points().spans().isEmpty()) {
+    m_pointsProgram->bind();
+
+    // sprite size from the shader; desktop compatibility profiles also need point sprites enabled for gl_PointCoord
+    const bool desktop = !context()->isOpenGLES();
+    const bool pointSprite = desktop && context()->format().profile() != QSurfaceFormat::CoreProfile;
+    if (desktop)
+      glEnable(GL_PROGRAM_POINT_SIZE);
+    if (pointSprite)
+      glEnable(GL_POINT_SPRITE);
+
+    m_pointsVao.bind();
+    for (const Viewport &vp : m_viewports) {
+      const QRect r = viewportPixels(vp, size);
+      glViewport(r.x(), r.y(), r.width(), r.height());
+      drawPoints(vp.camera, scale);
+    }
+    m_pointsVao.release();
 
-  if (m_drawGrid && m_gridVertexIdx > -1) {
-    glLineWidth(0.5f);
-    m_linesVao.bind();
-    glDrawArrays(GL_LINES, m_gridVertexIdx, m_axesVertexIdx - m_gridVertexIdx);
-    m_linesVao.release();
+    if (desktop)
+      glDisable(GL_PROGRAM_POINT_SIZE);
+    if (pointSprite)
+      glDisable(GL_POINT_SPRITE);
+
+    m_pointsProgram->release();
   }
 
-  if (m_drawAxes && m_axesVertexIdx > -1) {
-    glLineWidth(3);
+  // all lines in one draw per chunk, as screen-space quads; hidden categories are dropped in the shader
+  if (m_linesProgram != nullptr) {
+    m_linesProgram->bind();
+    m_linesProgram->setUniformValue("categories", QVector3D(1, m_drawGrid ? 1 : 0, m_drawAxes ? 1 : 0));
+    m_linesProgram->setUniformValue("feather", m_lineAntialiasing ? 1.0f : 0.0f);
+
+    // the quads face either way
+    glDisable(GL_CULL_FACE);
+    if (m_lineAntialiasing) {
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
     m_linesVao.bind();
-    glDrawArrays(GL_LINES, m_axesVertexIdx, m_data.lineVertexCount() - m_axesVertexIdx);
+    for (const Viewport &vp : m_viewports) {
+      const QRect r = viewportPixels(vp, size);
+      glViewport(r.x(), r.y(), r.width(), r.height());
+      m_linesProgram->setUniformValue(m_linesViewportSizeLoc, QVector2D(r.width(), r.height()) / scale);
+
+      // the first span holds the grid and axes, which are in absolute world coordinates
+      for (const GLLines::Span &span : m_scene->lines().spans()) {
+        m_linesProgram->setUniformValue(m_linesMvpMatrixLoc, vp.camera->toMatrix(chunkOrigin(span.chunk)));
+        m_scene->lines().draw(span);
+      }
+    }
     m_linesVao.release();
+
+    glDisable(GL_BLEND);
+    glEnable(GL_CULL_FACE);
+    m_linesProgram->release();
+  }
+
+  if (measure)
+    m_timeMonitor.recordSample();
+
+  // translucent objects, if any, over the opaque scene
+  if (m_scene->objects().hasTransparent()) {
+    m_transparency.begin(target, size, depthFormat);
+
+    for (const Viewport &vp : m_viewports) {
+      const QRect r = viewportPixels(vp, size);
+      glViewport(r.x(), r.y(), r.width(), r.height());
+      drawTriangles(transparentProgram, vp.camera, GLObjects::Transparent);
+    }
+
+    m_transparency.end(target);
   }
 
-  m_program->release();
+  if (measure)
+    m_timeMonitor.recordSample();
+
+  if (colormap)
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+  drawLabels(size, scale);
+
+  if (reverseZ)
+    m_glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+
+  if (renderTarget != nullptr)
+    renderTarget->blitTo(defaultFramebufferObject(), widgetSize);
+
+  if (measure) {
+    m_timeMonitor.recordSample();
+    m_timing = true;
+  }
+}
+
+const QGLViewer::SceneProgram &QGLViewer::sceneProgram(int features) {
+  SceneProgram &sceneProgram = m_scenePrograms[features];
+  if (sceneProgram.program != nullptr)
+    return sceneProgram;
+
+  int mask = features;
+
+  // without weighted blended OIT, translucent objects are blended with the opaque program,
+  // which doesn't depend on the depth range
+  if (!m_transparency.weightedBlended())
+    mask &= ~ShaderManager::Transparent;
+  if (!(mask & ShaderManager::Transparent))
+    mask &= ~ShaderManager::ReverseZ;
+
+  QOpenGLShaderProgram *program = ShaderManager::instance()->program(ShaderManager::Scene, ShaderManager::Features(QFlag(mask)));
+
+  // the same variant without edges, clipping or the colormap comes first
+  if (program == nullptr) {
+    for (int feature : { ShaderManager::Edges, ShaderManager::Clipping, ShaderManager::Colormap }) {
+      if (features & feature) {
+        std::cerr << "WARNING: scene program variant " << features << " unavailable, using one without feature " << feature << std::endl;
+        program = this->sceneProgram(features & ~feature).program;
+        break;
+      }
+    }
+  }
+  if (program == nullptr)
+    program = m_program;
+
+  sceneProgram = { program, program->uniformLocation("mvpMatrix"),
+                   program->uniformLocation("clipPlanes"), program->uniformLocation("clipPlaneCount") };
+  return sceneProgram;
+}
+
+DVector3 QGLViewer::chunkOrigin(int chunk) const {
+  return chunk < 0 ? DVector3() : m_scene->data().chunks()[chunk].origin;
+}
+
+void QGLViewer::drawTriangles(const SceneProgram &program, Camera *camera, GLObjects::Pass pass) {
+  GLObjects &objects = m_scene->objects();
+
+  // only reject what the program cuts: without a clipping variant, nothing is cut
+  const bool clipping = program.clipPlanesLoc != -1;
+
+  // the scalar buffer is empty without scalars, so its attribute is only enabled when colormapping,
+  // and likewise the edge attribute when drawing edges
+  auto enableScalars = [this]() {
+    if (colormapActive())
+      glEnableVertexAttribArray(GLScene::ScalarAttrib);
+    else
+      glDisableVertexAttribArray(GLScene::ScalarAttrib);
+
+    if (edgesActive())
+      glEnableVertexAttribArray(GLScene::EdgeAttrib);
+    else if (m_scene->edgesSupported())
+      glDisableVertexAttribArray(GLScene::EdgeAttrib);
+  };
+
+  auto setClipPlanes = [&program](const QVector<QVector4D> &planes) {
+    program.program->setUniformValueArray(program.clipPlanesLoc, planes.constData(), planes.size());
+    program.program->setUniformValue(program.clipPlaneCountLoc, planes.size());
+  };
+
+  if (m_gpuCulling && objects.gpuCulling()) {
+    // the culling moves every command by its chunk offset from the camera, computed in about double
+    // precision, so the vertices stay small however far the camera is from its origin; so are the planes
+    const DVector3 position = camera->worldTranslation();
+    const QMatrix4x4 viewProjection = camera->toMatrix(position);
+    const QVector<QVector4D> planes = clipping ? clipPlanes(position) : QVector<QVector4D>();
+    objects.cull(pass, viewProjection, position, planes);
+
+    program.program->bind();
+    program.program->setUniformValue(program.mvpMatrixLoc, viewProjection);
+    if (clipping)
+      setClipPlanes(planes);
+
+    m_culledTrisVao.bind();
+    enableScalars();
+    objects.drawCulled(pass);
+    m_culledTrisVao.release();
+    program.program->release();
+    return;
+  }
+
+  program.program->bind();
+  m_trisVao.bind();
+  enableScalars();
+
+  // chunks are drawn camera-relative, with the offset calculated in double precision
+  for (const GLObjects::Span &span : objects.spans()) {
+    const DVector3 origin = chunkOrigin(span.chunk);
+
+    // chunks that are cut away entirely are skipped before any uniform is set
+    QVector<QVector4D> planes;
+    if (clipping) {
+      planes = clipPlanes(origin);
+      if (objects.isClipped(span, planes))
+        continue;
+
+      setClipPlanes(planes);
+    }
+
+    program.program->setUniformValue(program.mvpMatrixLoc, camera->toMatrix(origin));
+    objects.draw(pass, span, planes);
+  }
+
+  m_trisVao.release();
+  program.program->release();
+}
+
+void QGLViewer::drawPoints(Camera *camera, float scale) {
+  const DVector3 position = camera->worldTranslation();
+
+  for (const GLPoints::Span &span : m_scene->points().spans()) {
+    const DVector3 origin = chunkOrigin(span.chunk);
+    const float density = GLPoints::density(span, (position - origin).toVector3D(),
+                                            m_pointConfig.fullDensityDistance, m_pointConfig.minDensity);
+
+    // fewer points, larger sprites to cover the same area
+    m_pointsProgram->setUniformValue(m_pointSizeLoc, scale * m_pointConfig.size / std::sqrt(density));
+    m_pointsProgram->setUniformValue(m_pointsMvpMatrixLoc, camera->toMatrix(origin));
+    m_scene->points().draw(span, density);
+  }
+}
+
+void QGLViewer::drawLabels(const QSize &size, float scale) {
+  GLLabels &labels = m_scene->labels();
+  if (m_labelsProgram == nullptr || !labels.isSupported() || labels.isEmpty())
+    return;
+
+  const bool shown[] = { true, m_drawGrid, m_drawAxes };
+
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  m_labelsProgram->bind();
+  m_labelsProgram->setUniformValue("atlas", 0);
+  m_labelsVao.bind();
+
+  for (const Viewport &vp : m_viewports) {
+    const QRect r = viewportPixels(vp, size);
+    glViewport(r.x(), r.y(), r.width(), r.height());
+
+    // labels are sized in widget pixels, like lines
+    const QSizeF pixels = QSizeF(r.size()) / scale;
+
+    m_labelInstances.clear();
+    labels.place(vp.camera, pixels, shown, m_labelInstances);
+
+    m_labelsVbo.bind();
+    m_labelsVbo.allocate(m_labelInstances.constData(), m_labelInstances.size() * sizeof(GLLabels::Instance));
+    m_labelsVbo.release();
+
+    m_labelsProgram->setUniformValue(m_labelsViewportSizeLoc, QVector2D(pixels.width(), pixels.height()));
+    labels.draw(m_labelInstances.size());
+  }
+
+  m_labelsVao.release();
+  m_labelsProgram->release();
+
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
 }
 
 void QGLViewer::resizeGL(int w, int h) {
-  m_camera->setAspectRatio(GLfloat(w) / h);
+  for (Viewport &vp : m_viewports)
+    vp.camera->setAspectRatio(GLfloat(w * vp.rect.width()) / GLfloat(h * vp.rect.height()));
 }
 
 void QGLViewer::keyPressEvent(QKeyEvent *event) {
@@ -295,6 +910,29 @@ void QGLViewer::keyPressEvent(QKeyEvent *event) {
       m_drawGrid = !m_drawGrid;
       break;
 
+    case Qt::Key_R:
+      setReverseZ(!m_reverseZ);
+      break;
+    case Qt::Key_C:
+      setGpuCulling(!m_gpuCulling);
+      break;
+    case Qt::Key_S:
+      m_colormapConfig.enabled = !m_colormapConfig.enabled;
+      break;
+    case Qt::Key_W:
+      m_edgeConfig.enabled = !m_edgeConfig.enabled;
+      break;
+    case Qt::Key_X: {
+      // a section plane through the camera target, cutting away what is in front of it
+      ClipConfig clip = m_clipConfig;
+      if (clip.planes.isEmpty())
+        clip.planes.push_back({ m_camera->origin() + m_camera->target(), m_camera->forwardVector() });
+      else
+        clip.planes.clear();
+      setClipConfig(clip);
+      break;
+    }
+
     case Qt::Key_0:
       m_camera->reset();
       break;
@@ -310,8 +948,16 @@ void QGLViewer::keyPressEvent(QKeyEvent *event) {
     case Qt::Key_T:
       m_camera->setCameraMode(CameraMode::Target);
       break;
-    case Qt::Key_L:  // log current camera data
+    case Qt::Key_L:  // log current camera data and frame times
       qDebug() << *m_camera;
+      qDebug() << "GPU frame time: opaque" << m_frameTimes.opaque << "ms, transparent" << m_frameTimes.transparent
+               << "ms, overlay" << m_frameTimes.overlay << "ms";
+      if (m_gpuCulling && m_scene->objects().gpuCulling()) {
+        makeCurrent();
+        qDebug() << "GPU culling: visible draw commands" << m_scene->objects().culledCount(GLObjects::Opaque)
+                 << "of" << m_scene->objects().commandCount();
+        doneCurrent();
+      }
       break;
   }
   update();
@@ -320,6 +966,11 @@ void QGLViewer::keyPressEvent(QKeyEvent *event) {
 
 void QGLViewer::mousePressEvent(QMouseEvent *event) {
   m_lastPos = event->pos();
+
+  // navigate the camera of the viewport that was clicked
+  int viewport = viewportAt(m_lastPos);
+  if (viewport > -1)
+    m_camera = m_viewports[viewport].camera;
 }
 
 void QGLViewer::mouseMoveEvent(QMouseEvent *event) {
@@ -362,6 +1013,7 @@ void QGLViewer::mouseMoveEvent(QMouseEvent *event) {
     m_camera->translate( dy * m_camera->upVector());
   }
 
+  interact();
   update();
 }
 
@@ -382,5 +1034,6 @@ void QGLViewer::wheelEvent(QWheelEvent *event) {
   m_camera->translate(factor * m_camera->forwardVector());
 
   event->accept();
+  interact();
   update();
 }
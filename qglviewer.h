@@ -4,33 +4,82 @@
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions>
 #include <QOpenGLVertexArrayObject>
-#include <QOpenGLBuffer>
+#include <QOpenGLTimeMonitor>
 
 #include <QMatrix4x4>
+#include <QRectF>
+#include <QTimer>
 
-#include "gldata.h"
+#include "glscene.h"
+#include "transparencypass.h"
+#include "rendertarget.h"
 
 QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
 QT_FORWARD_DECLARE_CLASS(Camera)
 
 
-struct GridConfig {
-  GridConfig();
+// how point clouds are drawn, see GLPoints::density()
+struct PointConfig {
+  PointConfig();
 
-  int minX, maxX;   // draw the grid from minX to maxX
-  int minY, maxY;   // ...and from minY to maxY
-  int step;
+  float size;                   // of the sprites in pixels
 
-  QVector3D color;  // grid color
+  // distance-based subsampling: all points up to this distance from a chunk,
+  // fewer beyond; 0 to always draw all points
+  float fullDensityDistance;
+  float minDensity;             // fraction of points drawn at least
 };
 
-struct AxesConfig {
-  AxesConfig();
+// render quality, reduced while the camera moves if adaptive
+struct QualityConfig {
+  QualityConfig();
 
-  float length;
-  float arrowSize;
+  int samples;                  // MSAA samples at full quality
 
-  QVector3D colorX, colorY, colorZ;
+  // lower the resolution and sample count step by step while the GPU time
+  // of a frame exceeds targetFrameTime during interaction, raise them again
+  // below half of it; full quality once the input is idle for idleDelay
+  bool adaptive;
+  float targetFrameTime;        // in ms
+  int idleDelay;                // in ms
+};
+
+// colors from the scalars of the triangle vertices, see GLData::setScalars()
+struct ColormapConfig {
+  ColormapConfig();
+
+  bool enabled;                 // instead of the vertex colors, if the data has scalars
+
+  // evenly spaced from minValue to maxValue, interpolated in between
+  QVector<QVector3D> colors;
+  float minValue, maxValue;
+  bool clamp;                   // values outside of the range get the end colors, or aren't drawn
+};
+
+// a half space, see ClipConfig
+struct ClipPlane {
+  DVector3 point;               // on the plane, in world coordinates
+  QVector3D normal;             // points to the side that is kept
+};
+
+// section planes and a box, outside of which the triangles are cut away
+struct ClipConfig {
+  ClipConfig();
+
+  QVector<ClipPlane> planes;
+
+  bool box;                     // keep only the inside of the box, too
+  DVector3 boxMin, boxMax;
+};
+
+// the edges of the triangles drawn over their faces
+struct EdgeConfig {
+  EdgeConfig();
+
+  bool enabled;
+  QVector3D color;
+  float width;                  // in pixels
+  bool featureEdgesOnly;        // hide the diagonals that split quads and cuboid faces
 };
 
 
@@ -44,13 +93,109 @@ public:
   QSize minimumSizeHint() const override;
   QSize sizeHint() const override;
 
+  // the camera of the active viewport, i.e., the one last clicked
   Camera *camera() const { return m_camera; }
 
+  /**
+   * Split the widget into several viewports, each with its own camera,
+   * all drawn with one set of binds. The rectangle is in widget coordinates
+   * normalized to [0, 1], origin top left. The first viewport initially
+   * covers the whole widget.
+   *
+   * @return the index of the new viewport
+   */
+  int addViewport(const QRectF &rect);
+  void setViewportRect(int viewport, const QRectF &rect);
+
+  int viewportCount() const                       { return m_viewports.size(); }
+  Camera *viewportCamera(int viewport) const      { return m_viewports[viewport].camera; }
+
+  /**
+   * Show the given scene, which may be shared with other viewers. Without a
+   * scene set, each viewer has its own. The convenience setters below
+   * modify the current scene, on the GUI thread; other threads submit their
+   * changes to the scene, see GLScene::submit().
+   */
+  void setScene(GLScene *scene);
+  GLScene *scene() const                          { return m_scene; }
+
   void setData(const GLData &data);
 
   void setGridConfig(const GridConfig &grid);
   void setAxesConfig(const AxesConfig &axes);
 
+  // object layer: the named objects of the data, see GLData::beginObject()
+  int objectCount() const;
+  int objectIndex(const QString &name) const;
+
+  void setObjectVisible(int object, bool visible);
+  void setObjectTransform(int object, const QMatrix4x4 &model);
+  void setObjectTint(int object, const QVector4D &tint);
+  void setObjectOpacity(int object, float opacity);
+
+  void setPointConfig(const PointConfig &points);
+  const PointConfig &pointConfig() const          { return m_pointConfig; }
+
+  void setQualityConfig(const QualityConfig &quality);
+  const QualityConfig &qualityConfig() const      { return m_qualityConfig; }
+
+  /**
+   * Map the scalars of the data to colors on the GPU. Changing the range
+   * only changes uniforms, and changing the colors uploads just the small
+   * colormap texture; the vertices stay as they are. To replace the scalars
+   * alone, use GLScene::setScalars().
+   */
+  void setColormapConfig(const ColormapConfig &colormap);
+  const ColormapConfig &colormapConfig() const    { return m_colormapConfig; }
+
+  /**
+   * Cut the triangles with section planes and a box in the shader. Chunks
+   * and objects that are cut away entirely aren't drawn at all, and moving a
+   * plane uploads nothing. At most GLObjects::maxClipPlanes planes, the box
+   * counts as 6. Only triangles are cut: lines, points and labels, including
+   * the grid and axes, are drawn whole.
+   */
+  void setClipConfig(const ClipConfig &clip);
+  const ClipConfig &clipConfig() const            { return m_clipConfig; }
+
+  /**
+   * Draw the edges of the triangles in the same pass as the faces: the
+   * fragment shader blends in the edge color by the distance to the closest
+   * edge, so no geometry is duplicated and there are no depth fighting
+   * lines. On OpenGL ES 2.0, needs standard derivatives and a 9th vertex
+   * attribute.
+   */
+  void setEdgeConfig(const EdgeConfig &edges);
+  const EdgeConfig &edgeConfig() const            { return m_edgeConfig; }
+
+  /**
+   * Cull the triangles on the GPU and draw all chunks with one draw per
+   * pass, see GLObjects. On by default; needs OpenGL 4.3, otherwise all
+   * triangles are drawn with one draw per chunk.
+   */
+  void setGpuCulling(bool culling);
+  bool gpuCulling() const                         { return m_gpuCulling; }
+
+  /**
+   * Reverse-Z: an infinite far plane and a floating point depth buffer for
+   * uniform depth precision at any distance. Needs glClipControl (OpenGL 4.5
+   * or ARB_clip_control); without it, the standard depth range is used.
+   */
+  void setReverseZ(bool reverse);
+  bool reverseZ() const                           { return m_reverseZ; }
+
+  // blend the edges of lines instead of relying on multisampling alone
+  void setLineAntialiasing(bool antialiasing);
+  bool lineAntialiasing() const                   { return m_lineAntialiasing; }
+
+  // GPU time in ms of the last measured frame, if timer queries are available
+  struct FrameTimes {
+    float opaque;       // triangles, points and lines
+    float transparent;  // translucent objects including compositing
+    float overlay;      // labels, and the blit of a multisampled or reduced-resolution target
+  };
+  const FrameTimes &frameTimes() const            { return m_frameTimes; }
+
 protected:
   void initializeGL() override;
   void paintGL() override;
@@ -61,35 +206,136 @@ protected:
   void wheelEvent(QWheelEvent *event) override;
 
 private:
-  void initializeGridAndAxes();
-  void setupGL();
-  void setupVertexAttribs();
+  struct Viewport {
+    QRectF rect;      // normalized widget coordinates
+    Camera *camera;
+  };
+
+  // a variant of the scene program
+  struct SceneProgram {
+    QOpenGLShaderProgram *program;
+    int mvpMatrixLoc;
+    int clipPlanesLoc;
+    int clipPlaneCountLoc;
+  };
+
+  // the scene program with the given ShaderManager features, linked on first use
+  const SceneProgram &sceneProgram(int features);
+
+  void setupVertexArrays();
+
+  // draw the point clouds in the current viewport, scale is the render resolution relative to the widget
+  void drawPoints(Camera *camera, float scale);
+
+  // place and draw the labels in every viewport, on top of the scene
+  void drawLabels(const QSize &size, float scale);
+
+  // reverse-Z requested and supported
+  bool reverseZActive() const;
+
+  // colormapping enabled and the data has scalars
+  bool colormapActive() const;
+
+  // edges enabled and the context has the vertex attribute for them
+  bool edgesActive() const;
+
+  // the colors of the colormap config into the colormap texture
+  void uploadColormap();
+
+  // draw the triangles of the pass in the current viewport, binds the triangle VAO
+  void drawTriangles(const SceneProgram &program, Camera *camera, GLObjects::Pass pass);
+
+  // the clip planes for vertices relative to the given origin
+  QVector<QVector4D> clipPlanes(const DVector3 &origin) const;
+
+  // the origin of a chunk, or (0, 0, 0) for -1
+  DVector3 chunkOrigin(int chunk) const;
+
+  // the viewport at the given widget position, or -1
+  int viewportAt(const QPoint &pos) const;
+
+  // in pixels of a framebuffer of the given size
+  QRect viewportPixels(const Viewport &vp, const QSize &size) const;
+
+  // the camera is moved by input, render at reduced quality until it's idle
+  void interact();
+
+  // adjust the quality level for the next interactive frames
+  void adaptQuality(float frameTime);
 
   QPoint m_lastPos;
 
-  GLData m_data;
+  GLScene *m_scene;
+  bool m_sceneAttached;   // the scene's buffers are usable in our context
 
   // draw as triangles
   QOpenGLVertexArrayObject m_trisVao;
-  QOpenGLBuffer m_trisVbo;
+  QOpenGLVertexArrayObject m_culledTrisVao;
+  bool m_gpuCulling;
 
-  // draw as lines: grid and axes
+  // draw as lines: data lines, grid and axes
   QOpenGLVertexArrayObject m_linesVao;
-  QOpenGLBuffer m_linesVbo;
 
-  bool m_drawGrid;
-  int m_gridVertexIdx;
-  GridConfig m_gridConfig;
+  // draw as point sprites
+  QOpenGLVertexArrayObject m_pointsVao;
+  PointConfig m_pointConfig;
+
+  // labels: the glyphs placed in a viewport, streamed into the instance buffer
+  QOpenGLVertexArrayObject m_labelsVao;
+  QOpenGLBuffer m_labelsVbo;
+  QVector<GLLabels::Instance> m_labelInstances;
 
+  bool m_drawGrid;
   bool m_drawAxes;
-  int m_axesVertexIdx;
-  AxesConfig m_axesConfig;
+  bool m_lineAntialiasing;
 
   QOpenGLShaderProgram *m_program;
+  QOpenGLShaderProgram *m_linesProgram;
+  QOpenGLShaderProgram *m_pointsProgram;
+  QOpenGLShaderProgram *m_labelsProgram;
+
+  // the variants of the scene program by ShaderManager::Transparent, ReverseZ, Colormap,
+  // Clipping and Edges, with fallbacks for the unsupported ones
+  SceneProgram m_scenePrograms[32];
+
+  ClipConfig m_clipConfig;
+  EdgeConfig m_edgeConfig;
+
+  // translucent objects
+  TransparencyPass m_transparency;
+
+  // scalars to colors: n x 1 texels, ES 2 has no 1D textures
+  ColormapConfig m_colormapConfig;
+  GLuint m_colormapTexture;
+  bool m_colormapDirty;
+
+  // the scene is rendered here, then resolved into the widget; one per quality level,
+  // so that starting and ending an interaction doesn't reallocate them
+  QVector<RenderTarget> m_renderTargets;
+
+  QualityConfig m_qualityConfig;
+  QTimer m_idleTimer;
+  bool m_interacting;
+  int m_interactiveLevel;   // quality level used during interaction, 0 is full quality
+
+  bool m_reverseZ;
+  typedef void (QOPENGLF_APIENTRYP ClipControl)(GLenum origin, GLenum depth);
+  ClipControl m_glClipControl;
+
+  // GPU timings: the frame's start, opaque, transparent and overlay end
+  QOpenGLTimeMonitor m_timeMonitor;
+  bool m_timing;    // samples recorded, but not yet read
+  int m_timedLevel; // quality level of the recorded frame, -1 if not interactive
+  FrameTimes m_frameTimes;
 
-  Camera *m_camera;
+  QVector<Viewport> m_viewports;
+  Camera *m_camera;   // of the active viewport
 
-  int m_mvpMatrixLoc;
+  int m_linesMvpMatrixLoc;
+  int m_linesViewportSizeLoc;
+  int m_pointsMvpMatrixLoc;
+  int m_pointSizeLoc;
+  int m_labelsViewportSizeLoc;
 };
 
 #endif
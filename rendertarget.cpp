@@ -0,0 +1,131 @@
+#include "rendertarget.h"
+
+#include <QOpenGLContext>
+
+#include <algorithm>
+#include <iostream>
+
+
+RenderTarget::RenderTarget()
+  : m_supported(false),
+    m_maxSamples(0),
+    m_samples(0),
+    m_floatDepth(false),
+    m_fbo(0),
+    m_colorRbo(0),
+    m_depthRbo(0),
+    m_resolveFbo(0),
+    m_resolveRbo(0)
+{}
+
+
+int RenderTarget::maxSamples() {
+  // multisampled renderbuffers, blits and packed float depth
+  QOpenGLContext *ctx = QOpenGLContext::currentContext();
+  if (ctx->format().version() < qMakePair(3, 0)) {
+    std::cerr << "WARNING: no multisampled framebuffers, rendering without antialiasing" << std::endl;
+    return 0;
+  }
+
+  GLint samples = 0;
+  ctx->functions()->glGetIntegerv(GL_MAX_SAMPLES, &samples);
+  return samples;
+}
+
+void RenderTarget::initializeGL(int maxSamples) {
+  initializeOpenGLFunctions();
+
+  m_maxSamples = maxSamples;
+  m_supported = maxSamples > 0;
+}
+
+void RenderTarget::destroyGL() {
+  if (m_fbo != 0) {
+    glDeleteFramebuffers(1, &m_fbo);
+    glDeleteRenderbuffers(1, &m_colorRbo);
+    glDeleteRenderbuffers(1, &m_depthRbo);
+  }
+
+  if (m_resolveFbo != 0) {
+    glDeleteFramebuffers(1, &m_resolveFbo);
+    glDeleteRenderbuffers(1, &m_resolveRbo);
+  }
+
+  m_fbo = m_colorRbo = m_depthRbo = 0;
+  m_resolveFbo = m_resolveRbo = 0;
+  m_size = QSize();
+}
+
+
+GLenum RenderTarget::depthFormat() const {
+  return m_floatDepth ? GL_DEPTH32F_STENCIL8 : GL_DEPTH24_STENCIL8;
+}
+
+void RenderTarget::resize(const QSize &size, int samples, bool floatDepth) {
+  if (!m_supported)
+    return;
+
+  samples = std::min(samples, m_maxSamples);
+
+  if (m_fbo != 0 && size == m_size && samples == m_samples && floatDepth == m_floatDepth)
+    return;
+
+  destroyGL();
+
+  m_size = size;
+  m_samples = samples;
+  m_floatDepth = floatDepth;
+
+  glGenFramebuffers(1, &m_fbo);
+  glGenRenderbuffers(1, &m_colorRbo);
+  glGenRenderbuffers(1, &m_depthRbo);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, m_colorRbo);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, GL_RGBA8, m_size.width(), m_size.height());
+
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depthRbo);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, depthFormat(), m_size.width(), m_size.height());
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorRbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depthRbo);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cerr << "ERROR: incomplete render target" << std::endl;
+}
+
+void RenderTarget::bind() {
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+}
+
+void RenderTarget::blitTo(GLuint target, const QSize &targetSize) {
+  GLuint source = m_fbo;
+
+  if (targetSize != m_size && m_samples > 0) {
+    if (m_resolveFbo == 0) {
+      glGenFramebuffers(1, &m_resolveFbo);
+      glGenRenderbuffers(1, &m_resolveRbo);
+
+      glBindRenderbuffer(GL_RENDERBUFFER, m_resolveRbo);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_size.width(), m_size.height());
+      glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+      glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFbo);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_resolveRbo);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_resolveFbo);
+    glBlitFramebuffer(0, 0, m_size.width(), m_size.height(), 0, 0, m_size.width(), m_size.height(),
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    source = m_resolveFbo;
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+  glBlitFramebuffer(0, 0, m_size.width(), m_size.height(), 0, 0, targetSize.width(), targetSize.height(),
+                    GL_COLOR_BUFFER_BIT, targetSize == m_size ? GL_NEAREST : GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, target);
+}
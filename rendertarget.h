@@ -0,0 +1,61 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include <QOpenGLExtraFunctions>
+#include <QSize>
+
+
+/**
+ * The framebuffer the scene is rendered into before it is resolved into the
+ * widget: multisampled, with a 24 bit or floating point depth buffer, which
+ * QOpenGLWidget itself can't provide. It may be smaller than the widget, e.g.,
+ * while the camera moves, and is then scaled up when resolved.
+ *
+ * Needs OpenGL 3.0 or OpenGL ES 3.0; otherwise isSupported() is false and the
+ * scene is rendered into the widget directly.
+ */
+class RenderTarget : protected QOpenGLExtraFunctions
+{
+public:
+  RenderTarget();
+
+  // the most samples the current context supports, 0 without multisampled framebuffers;
+  // queried once per view for all its targets, and warns if there are none
+  static int maxSamples();
+
+  void initializeGL(int maxSamples);
+  void destroyGL();
+
+  bool isSupported() const                        { return m_supported; }
+
+  // (re)allocate the buffers if anything changed
+  void resize(const QSize &size, int samples, bool floatDepth);
+
+  GLuint handle() const                           { return m_fbo; }
+  const QSize &size() const                       { return m_size; }
+  int samples() const                             { return m_samples; }
+  GLenum depthFormat() const;
+
+  void bind();
+
+  // resolve the color buffer into the target framebuffer of the given size
+  void blitTo(GLuint target, const QSize &targetSize);
+
+private:
+  bool m_supported;
+  int m_maxSamples;
+
+  QSize m_size;
+  int m_samples;
+  bool m_floatDepth;
+
+  GLuint m_fbo;
+  GLuint m_colorRbo;
+  GLuint m_depthRbo;
+
+  // multisampled buffers can't be scaled when resolved, so they are resolved here first
+  GLuint m_resolveFbo;
+  GLuint m_resolveRbo;
+};
+
+#endif  // RENDERTARGET_H
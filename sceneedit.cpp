@@ -0,0 +1,137 @@
+#include "sceneedit.h"
+
+#include <iostream>
+
+
+SceneEdit::SceneEdit()
+  : m_hasScalars(false),
+    m_hasGrid(false),
+    m_hasAxes(false)
+{}
+
+
+bool SceneEdit::isEmpty() const {
+  return m_content == nullptr && !m_hasScalars && !m_hasGrid && !m_hasAxes
+      && m_visible.isEmpty() && m_transforms.isEmpty() && m_tints.isEmpty();
+}
+
+void SceneEdit::setData(const GLData &data) {
+  auto content = std::make_shared<GLScene::Content>();
+  content->setData(data);
+  setContent(content);
+}
+
+void SceneEdit::setContent(const std::shared_ptr<const GLScene::Content> &content) {
+  m_content = content;
+
+  // the scalars and objects of the old data don't apply anymore
+  m_hasScalars = false;
+  m_scalars.clear();
+  m_visible.clear();
+  m_transforms.clear();
+  m_tints.clear();
+}
+
+void SceneEdit::setScalars(const QVector<GLfloat> &scalars) {
+  m_hasScalars = true;
+  m_scalars = scalars;
+}
+
+void SceneEdit::setGridConfig(const GridConfig &grid) {
+  m_hasGrid = true;
+  m_grid = grid;
+}
+
+void SceneEdit::setAxesConfig(const AxesConfig &axes) {
+  m_hasAxes = true;
+  m_axes = axes;
+}
+
+void SceneEdit::setObjectVisible(int object, bool visible) {
+  m_visible.insert(object, visible);
+}
+
+void SceneEdit::setObjectTransform(int object, const QMatrix4x4 &model) {
+  m_transforms.insert(object, model);
+}
+
+void SceneEdit::setObjectTint(int object, const QVector4D &tint) {
+  m_tints.insert(object, tint);
+}
+
+
+void SceneEdit::layout(const GLScene::Setup &sceneSetup) {
+  if (m_content == nullptr)
+    return;
+
+  GLScene::Setup setup = sceneSetup;
+  if (m_hasGrid)
+    setup.grid = m_grid;
+  if (m_hasAxes)
+    setup.axes = m_axes;
+
+  if (m_content->gridVertexIdx > -1 && m_content->setup == setup)
+    return;
+
+  // a copy, the arrays the layout doesn't touch stay shared
+  auto content = std::make_shared<GLScene::Content>(*m_content);
+  content->layout(setup);
+  m_content = content;
+}
+
+void SceneEdit::merge(const SceneEdit &later) {
+  if (later.m_content != nullptr)
+    setContent(later.m_content);
+  if (later.m_hasScalars)
+    setScalars(later.m_scalars);
+  if (later.m_hasGrid)
+    setGridConfig(later.m_grid);
+  if (later.m_hasAxes)
+    setAxesConfig(later.m_axes);
+
+  for (auto it = later.m_visible.constBegin(); it != later.m_visible.constEnd(); ++it)
+    m_visible.insert(it.key(), it.value());
+  for (auto it = later.m_transforms.constBegin(); it != later.m_transforms.constEnd(); ++it)
+    m_transforms.insert(it.key(), it.value());
+  for (auto it = later.m_tints.constBegin(); it != later.m_tints.constEnd(); ++it)
+    m_tints.insert(it.key(), it.value());
+}
+
+void SceneEdit::apply(GLScene &scene) const {
+  // the data is laid out for the scene's setup with these, so they come before it
+  if (m_hasGrid)
+    scene.setGridConfig(m_grid);
+  if (m_hasAxes)
+    scene.setAxesConfig(m_axes);
+
+  if (m_content != nullptr)
+    scene.setData(*m_content);
+  if (m_hasScalars)
+    scene.setScalars(m_scalars);
+
+  // the batch may have been built for other data than the scene shows by now
+  const int objects = scene.objectCount();
+  int stale = 0;
+
+  for (auto it = m_visible.constBegin(); it != m_visible.constEnd(); ++it) {
+    if (it.key() >= 0 && it.key() < objects)
+      scene.setObjectVisible(it.key(), it.value());
+    else
+      ++stale;
+  }
+  for (auto it = m_transforms.constBegin(); it != m_transforms.constEnd(); ++it) {
+    if (it.key() >= 0 && it.key() < objects)
+      scene.setObjectTransform(it.key(), it.value());
+    else
+      ++stale;
+  }
+  for (auto it = m_tints.constBegin(); it != m_tints.constEnd(); ++it) {
+    if (it.key() >= 0 && it.key() < objects)
+      scene.setObjectTint(it.key(), it.value());
+    else
+      ++stale;
+  }
+
+  if (stale > 0)
+    std::cerr << "WARNING: " << stale << " object change(s) for objects the scene doesn't have, ignored" << std::endl;
+}
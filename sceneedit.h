@@ -0,0 +1,74 @@
+#ifndef SCENEEDIT_H
+#define SCENEEDIT_H
+
+#include <QHash>
+#include <QMatrix4x4>
+#include <QVector4D>
+
+#include <memory>
+
+#include "gldata.h"
+#include "glscene.h"
+
+
+/**
+ * A batch of scene changes, built on any thread and handed to the views with
+ * GLScene::submit(). A batch is a plain value; the data and scalars are
+ * shared, so copying it doesn't copy them.
+ *
+ * Later changes of the same thing replace earlier ones, which is also how
+ * batches that arrive faster than the views render are coalesced into one.
+ */
+class SceneEdit
+{
+public:
+  SceneEdit();
+
+  bool isEmpty() const;
+
+  // replaces the whole data, and with it all changes of the scalars and objects before;
+  // prepares it for drawing here, on the calling thread, see GLScene::Content
+  void setData(const GLData &data);
+
+  // see GLScene::setScalars(), for the data as of this change
+  void setScalars(const QVector<GLfloat> &scalars);
+
+  void setGridConfig(const GridConfig &grid);
+  void setAxesConfig(const AxesConfig &axes);
+
+  void setObjectVisible(int object, bool visible);
+  void setObjectTransform(int object, const QMatrix4x4 &model);
+  void setObjectTint(int object, const QVector4D &tint);
+
+  // lay out the lines and labels of new data for the scene's setup, with the grid and
+  // axes of this batch if it has them; GLScene::submit() does that on the producer's thread
+  void layout(const GLScene::Setup &sceneSetup);
+
+  // append the changes of a later batch
+  void merge(const SceneEdit &later);
+
+  // apply the changes to the scene, on its thread
+  void apply(GLScene &scene) const;
+
+private:
+  void setContent(const std::shared_ptr<const GLScene::Content> &content);
+
+  // never changed once prepared, copies of the batch share it
+  std::shared_ptr<const GLScene::Content> m_content;
+
+  bool m_hasScalars;
+  QVector<GLfloat> m_scalars;
+
+  bool m_hasGrid;
+  GridConfig m_grid;
+
+  bool m_hasAxes;
+  AxesConfig m_axes;
+
+  // by object index
+  QHash<int, bool> m_visible;
+  QHash<int, QMatrix4x4> m_transforms;
+  QHash<int, QVector4D> m_tints;
+};
+
+#endif  // SCENEEDIT_H
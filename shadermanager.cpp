@@ -0,0 +1,613 @@
+#include "shadermanager.h"
+#include "globjects.h"
+#include "gllabels.h"
+#include "gllines.h"
+#include "glpoints.h"
+#include "glscene.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+
+#include <iostream>
+
+
+static const char *sceneVertexShaderSource = R"(
+  attribute vec3 vertex;
+  attribute vec3 color;
+
+  // per object
+  attribute mat4 model;
+  attribute vec4 tint;
+
+  uniform mat4 mvpMatrix;
+
+  varying highp vec4 triangle;
+
+  #ifdef COLORMAP
+  attribute float scalar;
+  varying highp float vertexScalar;
+  #endif
+
+  #ifdef CLIPPING
+  varying highp vec3 clipPosition;    // in the space of the clip planes
+  #endif
+
+  #ifdef EDGES
+  attribute vec4 edges;               // barycentric corner, and the edges to hide as bits by opposite corner
+  uniform bool featureEdges;          // hide the edges that only split quads
+
+  varying highp vec3 edgeDistance;    // barycentric, 0 on the edge opposite each corner
+  #endif
+
+  void main(void) {
+  #ifdef COLORMAP
+    // the colormap replaces the vertex color, the tint still applies
+    vertexScalar = scalar;
+    triangle = tint;
+  #else
+    triangle = vec4(color, 1.0) * tint;
+  #endif
+
+  #ifdef EDGES
+    // a hidden edge is never reached: its distance is 1 everywhere
+    edgeDistance = edges.xyz;
+    if (featureEdges)
+      edgeDistance = max(edgeDistance, mod(floor(edges.w / vec3(1.0, 2.0, 4.0)), 2.0));
+  #endif
+
+    vec4 position = model * vec4(vertex, 1.0);
+  #ifdef CLIPPING
+    clipPosition = position.xyz;
+  #endif
+    gl_Position = mvpMatrix * position;
+  }
+)";
+
+static const char *sceneFragmentShaderSource = R"(
+  #if defined(GL_ES) && defined(EDGES)
+  #extension GL_OES_standard_derivatives : enable
+  #endif
+
+  #ifdef GL_ES
+  precision highp float;
+  #endif
+
+  varying highp vec4 triangle;
+
+  #ifdef COLORMAP
+  uniform sampler2D colormap;     // n x 1 texels
+  uniform float colormapSize;     // n
+  uniform vec2 scalarRange;       // mapped to the first and last texel
+  uniform bool clampScalars;      // or discard fragments outside of the range
+
+  varying highp float vertexScalar;
+  #endif
+
+  #ifdef CLIPPING
+  uniform vec4 clipPlanes[MAX_CLIP_PLANES];
+  uniform int clipPlaneCount;
+
+  varying highp vec3 clipPosition;
+  #endif
+
+  #ifdef EDGES
+  uniform vec3 edgeColor;
+  uniform float edgeWidth;        // in pixels
+
+  varying highp vec3 edgeDistance;
+  #endif
+
+  void main() {
+  #ifdef CLIPPING
+    // a constant loop bound for GLSL ES 1.00
+    for (int i = 0; i < MAX_CLIP_PLANES; ++i) {
+      if (i < clipPlaneCount && dot(clipPlanes[i].xyz, clipPosition) + clipPlanes[i].w < 0.0)
+        discard;
+    }
+  #endif
+
+    vec4 color = triangle;
+
+  #ifdef COLORMAP
+    float t = (vertexScalar - scalarRange.x) / (scalarRange.y - scalarRange.x);
+    if (!clampScalars && (t < 0.0 || t > 1.0))
+      discard;
+
+    // between the centers of the first and last texel
+    float u = (clamp(t, 0.0, 1.0) * (colormapSize - 1.0) + 0.5) / colormapSize;
+    color.rgb *= texture2D(colormap, vec2(u, 0.5)).rgb;
+  #endif
+
+  #ifdef EDGES
+    // the distance to the closest edge in pixels, antialiased over one pixel
+    vec3 pixels = edgeDistance / max(fwidth(edgeDistance), vec3(1e-6));
+    float dist = min(min(pixels.x, pixels.y), pixels.z);
+    float edge = 1.0 - clamp(dist - 0.5 * edgeWidth + 0.5, 0.0, 1.0);
+    color.rgb = mix(color.rgb, edgeColor, edge);
+  #endif
+
+  #ifdef TRANSPARENT
+    // weighted blended order-independent transparency (McGuire, Bavoil 2013):
+    // the weight favors fragments close to the camera
+  #ifdef REVERSE_Z
+    float z = 1.0 - gl_FragCoord.z;
+  #else
+    float z = gl_FragCoord.z;
+  #endif
+
+    float a = color.a;
+    float w = clamp(a * max(1e-2, 3e3 * pow(1.0 - z, 3.0)), 1e-2, 3e3);
+
+    gl_FragData[0] = vec4(color.rgb * a * w, a);   // alpha: revealage, blended multiplicatively
+    gl_FragData[1] = vec4(a * w, 0.0, 0.0, 0.0);
+  #else
+    gl_FragColor = color;
+  #endif
+  }
+)";
+
+static const char *compositeVertexShaderSource = R"(
+  attribute vec2 vertex;
+
+  varying highp vec2 texCoord;
+
+  void main(void) {
+    texCoord = vertex * 0.5 + 0.5;
+    gl_Position = vec4(vertex, 0.0, 1.0);
+  }
+)";
+
+static const char *compositeFragmentShaderSource = R"(
+  #ifdef GL_ES
+  precision highp float;
+  #endif
+
+  uniform sampler2D accumTexture;
+  uniform sampler2D weightTexture;
+
+  varying highp vec2 texCoord;
+
+  void main() {
+    vec4 accum = texture2D(accumTexture, texCoord);
+    float revealage = accum.a;
+
+    // nothing translucent here
+    if (revealage >= 1.0)
+      discard;
+
+    float weight = texture2D(weightTexture, texCoord).r;
+    gl_FragColor = vec4(accum.rgb / max(weight, 1e-5), 1.0 - revealage);
+  }
+)";
+
+static const char *linesVertexShaderSource = R"(
+  attribute vec3 vertex;
+  attribute vec3 other;
+  attribute vec3 color;
+  attribute vec4 params;    // width in pixels, side, category, end
+
+  uniform mat4 mvpMatrix;
+  uniform vec2 viewportSize;    // in pixels
+  uniform vec3 categories;      // 1 if the data lines, grid, axes are shown
+  uniform float feather;        // width of the antialiased edge in pixels, 0 for none
+
+  varying highp vec3 lineColor;
+  varying highp float edge;         // distance from the center line in pixels
+  varying highp float halfWidth;
+  varying highp float coverage;     // lines thinner than a pixel are drawn 1 pixel wide and faded
+
+  void main(void) {
+    float category = params.z;
+    float shown = category < 0.5 ? categories.x : (category < 1.5 ? categories.y : categories.z);
+    if (shown < 0.5) {
+      // degenerate, outside the clip volume
+      gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+      return;
+    }
+
+    vec4 clipThis = mvpMatrix * vec4(vertex, 1.0);
+    vec4 clipOther = mvpMatrix * vec4(other, 1.0);
+
+    // an end behind the camera can't be projected, move it along the segment to the front
+    const float minW = 1e-5;
+    if (clipThis.w < minW && clipOther.w >= minW)
+      clipThis = mix(clipThis, clipOther, (minW - clipThis.w) / (clipOther.w - clipThis.w));
+    if (clipOther.w < minW && clipThis.w >= minW)
+      clipOther = mix(clipOther, clipThis, (minW - clipOther.w) / (clipThis.w - clipOther.w));
+
+    // the direction of the segment on the screen, from its first to its second end
+    vec2 screenThis = clipThis.xy / clipThis.w * viewportSize;
+    vec2 screenOther = clipOther.xy / clipOther.w * viewportSize;
+    vec2 dir = (screenOther - screenThis) * (1.0 - 2.0 * params.w);
+    dir = length(dir) > 1e-5 ? normalize(dir) : vec2(1.0, 0.0);
+
+    float width = max(params.x, 1.0);
+    halfWidth = 0.5 * width;
+    coverage = params.x / width;
+    edge = params.y * (halfWidth + 0.5 * feather);
+
+    // offset the corner perpendicular to the segment by edge pixels
+    vec2 offset = vec2(-dir.y, dir.x) * edge * 2.0 / viewportSize;
+
+    lineColor = color;
+    gl_Position = clipThis + vec4(offset * clipThis.w, 0.0, 0.0);
+  }
+)";
+
+static const char *linesFragmentShaderSource = R"(
+  #ifdef GL_ES
+  precision highp float;
+  #endif
+
+  uniform float feather;
+
+  varying highp vec3 lineColor;
+  varying highp float edge;
+  varying highp float halfWidth;
+  varying highp float coverage;
+
+  void main() {
+    float alpha = coverage;
+    if (feather > 0.0)
+      alpha *= clamp((halfWidth - abs(edge)) / feather + 0.5, 0.0, 1.0);
+
+    gl_FragColor = vec4(lineColor, alpha);
+  }
+)";
+
+static const char *pointsVertexShaderSource = R"(
+  attribute vec3 vertex;
+  attribute vec4 color;
+
+  uniform mat4 mvpMatrix;
+  uniform float pointSize;    // in pixels
+
+  varying highp vec3 pointColor;
+
+  void main(void) {
+    pointColor = color.rgb;
+    gl_Position = mvpMatrix * vec4(vertex, 1.0);
+    gl_PointSize = pointSize;
+  }
+)";
+
+static const char *pointsFragmentShaderSource = R"(
+  #ifdef GL_ES
+  precision highp float;
+  #endif
+
+  varying highp vec3 pointColor;
+
+  void main() {
+    // round sprites
+    vec2 p = gl_PointCoord * 2.0 - 1.0;
+    if (dot(p, p) > 1.0)
+      discard;
+
+    gl_FragColor = vec4(pointColor, 1.0);
+  }
+)";
+
+static const char *labelsVertexShaderSource = R"(
+  attribute vec2 corner;
+  attribute vec2 anchor;
+  attribute vec4 glyph;       // offset and size in pixels
+  attribute vec4 texRect;
+  attribute vec3 color;
+
+  uniform vec2 viewportSize;  // in pixels
+
+  varying highp vec2 texCoord;
+  varying highp vec3 labelColor;
+
+  void main(void) {
+    // the anchor snapped to a pixel, so the glyphs are sampled texel by texel
+    vec2 pixel = floor((anchor * 0.5 + 0.5) * viewportSize + 0.5) + glyph.xy + corner * glyph.zw;
+
+    texCoord = texRect.xy + corner * texRect.zw;
+    labelColor = color;
+    gl_Position = vec4(pixel / viewportSize * 2.0 - 1.0, 0.0, 1.0);
+  }
+)";
+
+static const char *labelsFragmentShaderSource = R"(
+  #ifdef GL_ES
+  precision highp float;
+  #endif
+
+  uniform sampler2D atlas;
+
+  varying highp vec2 texCoord;
+  varying highp vec3 labelColor;
+
+  void main() {
+    gl_FragColor = vec4(labelColor, texture2D(atlas, texCoord).a);
+  }
+)";
+
+static const char *cullComputeShaderSource = R"(
+  #version 430
+
+  layout(local_size_x = 64) in;
+
+  struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint first;
+    uint baseInstance;
+  };
+
+  struct ObjectData {
+    mat4 model;
+    vec4 tint;
+  };
+
+  struct CommandBounds {
+    vec3 minCorner;
+    int chunk;
+    vec3 maxCorner;
+    int padding;
+  };
+
+  struct ChunkOrigin {
+    vec4 high;
+    vec4 low;
+  };
+
+  layout(std430, binding = 0) readonly buffer Commands { DrawCommand commands[]; };
+  layout(std430, binding = 1) readonly buffer Objects { ObjectData objects[]; };
+  layout(std430, binding = 2) readonly buffer Bounds { CommandBounds bounds[]; };
+  layout(std430, binding = 3) readonly buffer Chunks { ChunkOrigin chunks[]; };
+  layout(std430, binding = 4) writeonly buffer Culled { DrawCommand culled[]; };
+  layout(std430, binding = 5) writeonly buffer CulledObjects { ObjectData culledObjects[]; };
+
+  layout(binding = 0, offset = 0) uniform atomic_uint visibleCount;
+
+  uniform mat4 viewProjection;    // for vertices relative to the camera position
+  uniform vec3 cameraHigh;        // camera position, high + low
+  uniform vec3 cameraLow;
+  uniform int commandCount;       // int: QOpenGLShaderProgram sets no unsigned uniforms
+  uniform bool compact;           // pack the visible commands, or keep their place
+
+  uniform vec4 clipPlanes[MAX_CLIP_PLANES];   // relative to the camera position
+  uniform int clipPlaneCount;
+
+  void main() {
+    uint cmd = gl_GlobalInvocationID.x;
+    if (cmd >= uint(commandCount))
+      return;
+
+    DrawCommand command = commands[cmd];
+    CommandBounds box = bounds[cmd];
+    ObjectData object = objects[command.baseInstance];
+
+    // offset of the chunk from the camera, in about double precision
+    vec3 offset = -cameraHigh - cameraLow;
+    if (box.chunk >= 0)
+      offset = (chunks[box.chunk].high.xyz - cameraHigh) + (chunks[box.chunk].low.xyz - cameraLow);
+
+    // translate(offset) * model
+    mat4 model = object.model;
+    for (int c = 0; c < 4; ++c)
+      model[c].xyz += offset * model[c].w;
+
+    bool visible = command.instanceCount > 0u && command.count > 0u;
+
+    if (visible) {
+      // outside if all corners are beyond the same side plane or behind the camera
+      mat4 mvp = viewProjection * model;
+      ivec4 outside = ivec4(0);
+      int behind = 0;
+
+      for (int i = 0; i < 8; ++i) {
+        vec3 corner = vec3((i & 1) != 0 ? box.maxCorner.x : box.minCorner.x,
+                           (i & 2) != 0 ? box.maxCorner.y : box.minCorner.y,
+                           (i & 4) != 0 ? box.maxCorner.z : box.minCorner.z);
+        vec4 clip = mvp * vec4(corner, 1.0);
+
+        outside += ivec4(clip.x < -clip.w, clip.x > clip.w, clip.y < -clip.w, clip.y > clip.w);
+        behind += clip.w <= 0.0 ? 1 : 0;
+      }
+
+      visible = all(lessThan(outside, ivec4(8))) && behind < 8;
+
+      // or all corners beyond the same clip plane
+      for (int p = 0; p < clipPlaneCount && visible; ++p) {
+        int clipped = 0;
+
+        for (int i = 0; i < 8; ++i) {
+          vec3 corner = vec3((i & 1) != 0 ? box.maxCorner.x : box.minCorner.x,
+                             (i & 2) != 0 ? box.maxCorner.y : box.minCorner.y,
+                             (i & 4) != 0 ? box.maxCorner.z : box.minCorner.z);
+          vec4 position = model * vec4(corner, 1.0);
+
+          clipped += dot(clipPlanes[p], vec4(position.xyz, 1.0)) < 0.0 ? 1 : 0;
+        }
+
+        visible = clipped < 8;
+      }
+    }
+
+    if (visible) {
+      // the culled objects are indexed by command
+      culledObjects[cmd] = ObjectData(model, object.tint);
+      command.baseInstance = cmd;
+
+      uint idx = atomicCounterIncrement(visibleCount);
+      culled[compact ? idx : cmd] = command;
+    } else if (!compact) {
+      command.instanceCount = 0u;
+      culled[cmd] = command;
+    }
+  }
+)";
+
+
+struct AttributeLocation {
+  const char *name;
+  int location;
+};
+
+struct ProgramSource {
+  const char *vertex;
+  const char *fragment;
+  QVector<AttributeLocation> attributes;
+
+  // #version for desktop OpenGL if the shaders need more than GLSL 1.10
+  const char *desktopVersion;
+  // a compute program has only this shader
+  const char *compute;
+};
+
+static ProgramSource programSource(ShaderManager::Program program) {
+  switch (program) {
+    case ShaderManager::Scene:
+      return { sceneVertexShaderSource, sceneFragmentShaderSource, {
+          { "vertex", 0 },
+          { "color", 1 },
+          { "model", GLObjects::ModelAttrib },
+          { "tint", GLObjects::TintAttrib },
+          { "scalar", GLScene::ScalarAttrib },
+          { "edges", GLScene::EdgeAttrib }
+        } };
+
+    case ShaderManager::TransparencyComposite:
+      return { compositeVertexShaderSource, compositeFragmentShaderSource, {
+          { "vertex", 0 }
+        } };
+
+    case ShaderManager::Lines:
+      return { linesVertexShaderSource, linesFragmentShaderSource, {
+          { "vertex", GLLines::VertexAttrib },
+          { "other", GLLines::OtherAttrib },
+          { "color", GLLines::ColorAttrib },
+          { "params", GLLines::ParamsAttrib }
+        } };
+
+    case ShaderManager::Points:
+      // gl_PointCoord is GLSL 1.20
+      return { pointsVertexShaderSource, pointsFragmentShaderSource, {
+          { "vertex", GLPoints::VertexAttrib },
+          { "color", GLPoints::ColorAttrib }
+        }, "#version 120\n" };
+
+    case ShaderManager::Labels:
+      return { labelsVertexShaderSource, labelsFragmentShaderSource, {
+          { "corner", GLLabels::CornerAttrib },
+          { "anchor", GLLabels::AnchorAttrib },
+          { "glyph", GLLabels::GlyphAttrib },
+          { "texRect", GLLabels::TexRectAttrib },
+          { "color", GLLabels::ColorAttrib }
+        } };
+
+    case ShaderManager::CullCommands:
+      return { nullptr, nullptr, {}, nullptr, cullComputeShaderSource };
+  }
+
+  return { nullptr, nullptr, {}, nullptr, nullptr };
+}
+
+// the #define for each feature flag
+static const struct {
+  ShaderManager::Feature feature;
+  const char *define;
+} featureDefines[] = {
+  { ShaderManager::Transparent, "TRANSPARENT" },
+  { ShaderManager::ReverseZ, "REVERSE_Z" },
+  { ShaderManager::Colormap, "COLORMAP" },
+  { ShaderManager::Clipping, "CLIPPING" },
+  { ShaderManager::Edges, "EDGES" }
+};
+
+
+
+static QHash<QOpenGLContextGroup *, ShaderManager *> managers;
+
+ShaderManager *ShaderManager::instance() {
+  QOpenGLContext *ctx = QOpenGLContext::currentContext();
+  if (ctx == nullptr) {
+    std::cerr << "ERROR: ShaderManager needs a current OpenGL context" << std::endl;
+    return nullptr;
+  }
+
+  QOpenGLContextGroup *group = ctx->shareGroup();
+
+  ShaderManager *manager = managers.value(group);
+  if (manager == nullptr) {
+    manager = new ShaderManager(group);
+    managers.insert(group, manager);
+  }
+
+  return manager;
+}
+
+// the manager and its programs are deleted along with the share group
+ShaderManager::ShaderManager(QOpenGLContextGroup *group)
+  : QObject(group),
+    m_group(group)
+{}
+
+ShaderManager::~ShaderManager() {
+  managers.remove(m_group);
+}
+
+
+QOpenGLShaderProgram *ShaderManager::program(Program program, Features features) {
+  quint64 key = (quint64(program) << 32) | quint64(features);
+
+  auto it = m_programs.constFind(key);
+  if (it != m_programs.constEnd())
+    return it.value();
+
+  QOpenGLShaderProgram *p = build(program, features);
+  m_programs.insert(key, p);
+  return p;
+}
+
+QOpenGLShaderProgram *ShaderManager::build(Program program, Features features) {
+  const ProgramSource source = programSource(program);
+
+  QByteArray defines;
+  if (source.desktopVersion != nullptr && !QOpenGLContext::currentContext()->isOpenGLES())
+    defines += source.desktopVersion;
+
+  defines += "#define MAX_CLIP_PLANES " + QByteArray::number(GLObjects::maxClipPlanes) + '\n';
+
+  for (const auto &fd : featureDefines) {
+    if (fd.define != nullptr && features.testFlag(fd.feature))
+      defines += QByteArray("#define ") + fd.define + '\n';
+  }
+
+  // cacheable shaders are linked from a program binary if Qt has one, in memory or on disk
+  QOpenGLShaderProgram *p = new QOpenGLShaderProgram(this);
+  if (source.compute != nullptr) {
+    p->addCacheableShaderFromSourceCode(QOpenGLShader::Compute, withDefines(source.compute, defines));
+  } else {
+    p->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, withDefines(source.vertex, defines));
+    p->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, withDefines(source.fragment, defines));
+  }
+
+  for (const AttributeLocation &attr : source.attributes)
+    p->bindAttributeLocation(attr.name, attr.location);
+
+  if (!p->link()) {
+    std::cerr << "ERROR: failed to link: " << p->log().toStdString();
+    delete p;
+    return nullptr;
+  }
+
+  return p;
+}
+
+QByteArray ShaderManager::withDefines(const char *source, const QByteArray &defines) {
+  QByteArray src(source);
+
+  // the defines have to come after a #version directive
+  int versionIdx = src.indexOf("#version");
+  if (versionIdx > -1) {
+    int eol = src.indexOf('\n', versionIdx);
+    return src.left(eol + 1) + defines + src.mid(eol + 1);
+  }
+
+  return defines + src;
+}
@@ -0,0 +1,65 @@
+#ifndef SHADERMANAGER_H
+#define SHADERMANAGER_H
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+
+QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
+QT_FORWARD_DECLARE_CLASS(QOpenGLContextGroup)
+
+
+/**
+ * Compiles and links the shader programs once per group of shared contexts.
+ *
+ * Each program comes in variants selected by feature flags; a variant is the
+ * same source with a #define per feature. Variants are compiled on first use
+ * and cached. Linked program binaries are also stored on disk by Qt's shader
+ * cache, so the next start of the application does not compile at all.
+ */
+class ShaderManager : public QObject
+{
+  Q_OBJECT
+public:
+  enum Program {
+    Scene,
+    TransparencyComposite,
+    Lines,
+    Points,
+    Labels,
+    CullCommands      // compute shader, OpenGL 4.3
+  };
+
+  enum Feature {
+    NoFeatures  = 0,
+    Transparent = 1 << 0,   // weighted blended OIT accumulation
+    ReverseZ    = 1 << 1,   // depth is 1 at the near plane
+    Colormap    = 1 << 2,   // scene colors from the vertex scalars and a colormap texture
+    Clipping    = 1 << 3,   // discard scene fragments outside of the clip planes
+    Edges       = 1 << 4    // overlay the triangle edges, from barycentric coordinates
+  };
+  Q_DECLARE_FLAGS(Features, Feature)
+
+  // the shader manager of the share group of the current context
+  static ShaderManager *instance();
+
+  // the given variant of the program, compiled and linked on first use; nullptr on failure
+  QOpenGLShaderProgram *program(Program program, Features features = NoFeatures);
+
+private:
+  explicit ShaderManager(QOpenGLContextGroup *group);
+  ~ShaderManager() override;
+
+  QOpenGLShaderProgram *build(Program program, Features features);
+
+  static QByteArray withDefines(const char *source, const QByteArray &defines);
+
+  QOpenGLContextGroup *m_group;
+
+  // (program, features) => linked program or nullptr if it failed
+  QHash<quint64, QOpenGLShaderProgram *> m_programs;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(ShaderManager::Features)
+
+#endif  // SHADERMANAGER_H
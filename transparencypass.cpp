@@ -0,0 +1,170 @@
+#include "transparencypass.h"
+#include "shadermanager.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+
+#include <iostream>
+
+
+TransparencyPass::TransparencyPass()
+  : m_depthFormat(GL_NONE),
+    m_fbo(0),
+    m_textures{ 0, 0 },
+    m_depthRbo(0),
+    m_compositeProgram(nullptr)
+{}
+
+
+void TransparencyPass::initializeGL() {
+  initializeOpenGLFunctions();
+
+  // floating point render targets, MRT and depth blits
+  QOpenGLContext *ctx = QOpenGLContext::currentContext();
+  bool supported = ctx->isOpenGLES()
+      ? ctx->format().version() >= qMakePair(3, 2)
+        || (ctx->format().version() >= qMakePair(3, 0) && ctx->hasExtension("GL_EXT_color_buffer_float"))
+      : ctx->format().version() >= qMakePair(3, 0);
+
+  if (!supported) {
+    std::cerr << "WARNING: no floating point render targets, translucent objects are blended unsorted" << std::endl;
+    return;
+  }
+
+  m_compositeProgram = ShaderManager::instance()->program(ShaderManager::TransparencyComposite);
+  if (m_compositeProgram == nullptr)
+    return;
+
+  static const GLfloat triangle[] = { -1, -1,  3, -1,  -1, 3 };
+
+  m_triangleVao.create();
+  m_triangleVao.bind();
+  m_triangleVbo.create();
+  m_triangleVbo.bind();
+  m_triangleVbo.allocate(triangle, sizeof(triangle));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+  m_triangleVbo.release();
+  m_triangleVao.release();
+}
+
+void TransparencyPass::destroyGL() {
+  destroyFramebuffer();
+
+  m_triangleVbo.destroy();
+  m_triangleVao.destroy();
+  m_compositeProgram = nullptr;
+}
+
+
+void TransparencyPass::destroyFramebuffer() {
+  if (m_fbo != 0) {
+    glDeleteFramebuffers(1, &m_fbo);
+    glDeleteTextures(2, m_textures);
+    glDeleteRenderbuffers(1, &m_depthRbo);
+  }
+
+  m_fbo = m_textures[0] = m_textures[1] = m_depthRbo = 0;
+}
+
+void TransparencyPass::resize(const QSize &size, GLenum depthFormat) {
+  destroyFramebuffer();
+
+  m_size = size;
+  m_depthFormat = depthFormat;
+
+  glGenFramebuffers(1, &m_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+
+  glGenTextures(2, m_textures);
+  for (int i = 0; i < 2; ++i) {
+    glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_size.width(), m_size.height(), 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, m_textures[i], 0);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // same format as the opaque depth, so it can be blitted
+  glGenRenderbuffers(1, &m_depthRbo);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depthRbo);
+  glRenderbufferStorage(GL_RENDERBUFFER, m_depthFormat, m_size.width(), m_size.height());
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depthRbo);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cerr << "ERROR: incomplete transparency framebuffer" << std::endl;
+}
+
+void TransparencyPass::begin(GLuint target, const QSize &size, GLenum depthFormat) {
+  glDepthMask(GL_FALSE);
+  glEnable(GL_BLEND);
+
+  if (!weightedBlended()) {
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    return;
+  }
+
+  if (m_fbo == 0 || m_size != size || m_depthFormat != depthFormat)
+    resize(size, depthFormat);
+
+  // the opaque depth occludes translucent fragments
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+  glBlitFramebuffer(0, 0, m_size.width(), m_size.height(), 0, 0, m_size.width(), m_size.height(),
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+
+  static const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+  glDrawBuffers(2, buffers);
+
+  static const GLfloat accumClear[] = { 0, 0, 0, 1 };
+  static const GLfloat weightClear[] = { 0, 0, 0, 0 };
+  glClearBufferfv(GL_COLOR, 0, accumClear);
+  glClearBufferfv(GL_COLOR, 1, weightClear);
+
+  // colors and weights are summed up, the revealage is multiplied by (1 - alpha)
+  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void TransparencyPass::end(GLuint target) {
+  glDepthMask(GL_TRUE);
+
+  if (!weightedBlended()) {
+    glDisable(GL_BLEND);
+    return;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, target);
+  glViewport(0, 0, m_size.width(), m_size.height());
+
+  glDisable(GL_DEPTH_TEST);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_textures[1]);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_textures[0]);
+
+  m_compositeProgram->bind();
+  m_compositeProgram->setUniformValue("accumTexture", 0);
+  m_compositeProgram->setUniformValue("weightTexture", 1);
+
+  m_triangleVao.bind();
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  m_triangleVao.release();
+
+  m_compositeProgram->release();
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,58 @@
+#ifndef TRANSPARENCYPASS_H
+#define TRANSPARENCYPASS_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QSize>
+
+QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
+
+
+/**
+ * Translucent geometry with weighted blended order-independent transparency:
+ * a single pass without sorting that accumulates weighted colors and the
+ * revealage into two floating point targets, composited over the opaque scene.
+ *
+ * The translucent geometry has to be drawn between begin() and end() with the
+ * ShaderManager::Transparent variant of the scene program. Without floating
+ * point render targets, it is blended directly, unsorted, with the plain
+ * scene program instead.
+ */
+class TransparencyPass : protected QOpenGLExtraFunctions
+{
+public:
+  TransparencyPass();
+
+  void initializeGL();
+  void destroyGL();
+
+  bool weightedBlended() const                    { return m_compositeProgram != nullptr; }
+
+  // start drawing translucent geometry over the opaque scene in the target framebuffer,
+  // whose depth buffer has the given size and format
+  void begin(GLuint target, const QSize &size, GLenum depthFormat);
+
+  // composite the translucent geometry into the target framebuffer
+  void end(GLuint target);
+
+private:
+  void resize(const QSize &size, GLenum depthFormat);
+  void destroyFramebuffer();
+
+  QSize m_size;   // in device pixels
+  GLenum m_depthFormat;
+
+  // color 0: weighted color sum and revealage, color 1: weight sum
+  GLuint m_fbo;
+  GLuint m_textures[2];
+  GLuint m_depthRbo;
+
+  QOpenGLShaderProgram *m_compositeProgram;
+
+  // fullscreen triangle
+  QOpenGLVertexArrayObject m_triangleVao;
+  QOpenGLBuffer m_triangleVbo;
+};
+
+#endif  // TRANSPARENCYPASS_H